@@ -0,0 +1,420 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include <lcms2.h>
+
+#include <dicomicc.h>
+
+// Synthetic frames are square with this many pixels per side
+#define BENCH_FRAME_SIZE 2048
+
+// Size of the square tiles that are measured, the last one is a full frame
+static const uint32_t tile_sizes[] = { 256, 512, 1024, BENCH_FRAME_SIZE };
+
+static const struct {
+    DcmIccOutputType type;
+    const char *name;
+} output_types[] = {
+    { DCM_ICC_OUTPUT_SRGB, "srgb" },
+    { DCM_ICC_OUTPUT_DISPLAY_P3, "display-p3" },
+    { DCM_ICC_OUTPUT_ADOBE_RGB, "adobe-rgb" },
+    { DCM_ICC_OUTPUT_ROMM_RGB, "romm-rgb" },
+};
+
+// The synthetic profile is a matrix/TRC profile, so engines are measured
+// with fast paths disabled and the fast path on its own
+static const struct {
+    DcmIccEngine engine;
+    bool fast_paths;
+    const char *name;
+} engines[] = {
+    { DCM_ICC_ENGINE_LCMS2, false, "lcms2" },
+    { DCM_ICC_ENGINE_LUT3D, false, "lut3d" },
+    { DCM_ICC_ENGINE_LUT24, false, "lut24" },
+    { DCM_ICC_ENGINE_LCMS2, true, "fast-paths" },
+};
+
+#define COUNT(array) (sizeof(array) / sizeof((array)[0]))
+
+typedef struct {
+    char *data;
+    uint32_t size;
+} BenchProfile;
+
+typedef struct {
+    double min_time;
+    uint32_t max_threads;
+    FILE *output;
+    bool first_result;
+} BenchOptions;
+
+static double now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double)time.tv_sec + (double)time.tv_nsec * 1e-9;
+}
+
+/**
+ * Create a matrix/shaper profile resembling that of a slide scanner camera,
+ * with primaries and gamma that differ from all output profiles
+ */
+static bool create_profile(BenchProfile *profile) {
+    const cmsCIExyY white_point = { 0.3127, 0.3290, 1.0 };
+    const cmsCIExyYTRIPLE primaries = {
+        { 0.6600, 0.3200, 1.0 },
+        { 0.2800, 0.6300, 1.0 },
+        { 0.1450, 0.0650, 1.0 },
+    };
+
+    cmsToneCurve *curve = cmsBuildGamma(NULL, 1.9);
+    if (curve == NULL) {
+        return false;
+    }
+    cmsToneCurve *curves[3] = { curve, curve, curve };
+    cmsHPROFILE handle = cmsCreateRGBProfile(&white_point, &primaries, curves);
+    cmsFreeToneCurve(curve);
+    if (handle == NULL) {
+        return false;
+    }
+
+    cmsUInt32Number size = 0;
+    bool success = false;
+    if (cmsSaveProfileToMem(handle, NULL, &size) && size > 0) {
+        profile->data = malloc(size);
+        if (profile->data != NULL &&
+            cmsSaveProfileToMem(handle, profile->data, &size)) {
+            profile->size = size;
+            success = true;
+        }
+    }
+    cmsCloseProfile(handle);
+
+    return success;
+}
+
+/**
+ * Fill a frame with smooth gradients and noise, which resembles stained
+ * tissue more than uniform noise does and exercises all LUT cells
+ */
+static void fill_frame(uint8_t *frame, uint32_t size, bool planar) {
+    const size_t number_of_pixels = (size_t)size * size;
+    uint32_t state = 0x12345678;
+
+    for (uint32_t y = 0; y < size; y++) {
+        for (uint32_t x = 0; x < size; x++) {
+            const size_t i = (size_t)y * size + x;
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            const uint32_t noise = state & 0x1f;
+            const uint8_t samples[3] = {
+                (uint8_t)((x * 255 / size + noise) & 0xff),
+                (uint8_t)((y * 255 / size + (noise >> 1)) & 0xff),
+                (uint8_t)(((x + y) * 127 / size + noise) & 0xff),
+            };
+            for (int c = 0; c < 3; c++) {
+                if (planar) {
+                    frame[c * number_of_pixels + i] = samples[c];
+                } else {
+                    frame[i * 3 + c] = samples[c];
+                }
+            }
+        }
+    }
+}
+
+static void begin_result(BenchOptions *options, const char *kind) {
+    fprintf(options->output, "%s\n    {\"kind\": \"%s\"",
+            options->first_result ? "" : ",", kind);
+    options->first_result = false;
+}
+
+static void create_options(DcmIccTransformOptions *transform_options,
+                           DcmIccOutputType output_type,
+                           DcmIccEngine engine,
+                           bool fast_paths,
+                           bool planar) {
+    dcm_icc_transform_options_init(transform_options);
+    transform_options->output_type = output_type;
+    transform_options->engine = engine;
+    transform_options->fast_paths = fast_paths;
+    transform_options->planar_configuration = planar ? 1 : 0;
+}
+
+static void bench_creation(BenchOptions *options, const BenchProfile *profile) {
+    for (size_t e = 0; e < COUNT(engines); e++) {
+        for (size_t o = 0; o < COUNT(output_types); o++) {
+            DcmIccTransformOptions transform_options;
+            create_options(&transform_options, output_types[o].type,
+                           engines[e].engine, engines[e].fast_paths,
+                           false);
+
+            // Cold creation compiles the pipeline, warm creation hits the cache
+            dcm_icc_transform_cache_clear();
+            double begin = now();
+            DmcIccTransform *cold = dcm_icc_transform_create_with_options(
+                profile->data, profile->size, 256, 256, &transform_options);
+            const double cold_time = now() - begin;
+
+            begin = now();
+            DmcIccTransform *warm = dcm_icc_transform_create_with_options(
+                profile->data, profile->size, 256, 256, &transform_options);
+            const double warm_time = now() - begin;
+
+            if (cold != NULL && warm != NULL) {
+                begin_result(options, "creation");
+                fprintf(options->output,
+                        ", \"engine\": \"%s\", \"output_type\": \"%s\""
+                        ", \"cold_ms\": %.3f, \"warm_ms\": %.4f}",
+                        engines[e].name, output_types[o].name,
+                        cold_time * 1e3, warm_time * 1e3);
+            }
+            dcm_icc_transform_destroy(cold);
+            dcm_icc_transform_destroy(warm);
+        }
+    }
+}
+
+/**
+ * Apply a transform repeatedly for at least the minimum time and return the
+ * throughput in megapixels per second
+ */
+static double measure_throughput(const BenchOptions *options,
+                                 const DmcIccTransform *transform,
+                                 DcmIccThreadPool *pool,
+                                 const uint8_t *frame,
+                                 uint8_t *corrected_frame,
+                                 uint32_t tile_size) {
+    const uint32_t frame_size = tile_size * tile_size * 3;
+    uint64_t pixels = 0;
+    double elapsed = 0.0;
+
+    // Warm up, e.g. caches and lazily populated tables
+    dcm_icc_transform_apply(transform, (const char *)frame, frame_size,
+                            (char *)corrected_frame);
+
+    const double begin = now();
+    do {
+        if (pool != NULL) {
+            dcm_icc_transform_apply_parallel(transform, pool,
+                                             (const char *)frame, frame_size,
+                                             (char *)corrected_frame);
+        } else {
+            dcm_icc_transform_apply(transform, (const char *)frame, frame_size,
+                                    (char *)corrected_frame);
+        }
+        pixels += (uint64_t)tile_size * tile_size;
+        elapsed = now() - begin;
+    } while (elapsed < options->min_time);
+
+    return (double)pixels / elapsed * 1e-6;
+}
+
+static void bench_throughput(BenchOptions *options,
+                             const BenchProfile *profile,
+                             const uint8_t *frames[2],
+                             uint8_t *corrected_frame) {
+    for (size_t e = 0; e < COUNT(engines); e++) {
+        for (size_t o = 0; o < COUNT(output_types); o++) {
+            for (int planar = 0; planar < 2; planar++) {
+                for (size_t t = 0; t < COUNT(tile_sizes); t++) {
+                    const uint32_t tile_size = tile_sizes[t];
+                    DcmIccTransformOptions transform_options;
+                    create_options(&transform_options, output_types[o].type,
+                                   engines[e].engine, engines[e].fast_paths,
+                                   planar);
+                    DmcIccTransform *transform = dcm_icc_transform_create_with_options(
+                        profile->data, profile->size,
+                        (uint16_t)tile_size, (uint16_t)tile_size, &transform_options);
+                    if (transform == NULL) {
+                        continue;
+                    }
+
+                    // Tiles are the first pixels of the synthetic frames
+                    const double megapixels = measure_throughput(options,
+                                                                 transform,
+                                                                 NULL,
+                                                                 frames[planar],
+                                                                 corrected_frame,
+                                                                 tile_size);
+
+                    begin_result(options, "throughput");
+                    fprintf(options->output,
+                            ", \"engine\": \"%s\", \"kernel\": \"%s\""
+                            ", \"output_type\": \"%s\", \"planar\": %s"
+                            ", \"tile_size\": %u, \"threads\": 1"
+                            ", \"megapixels_per_second\": %.2f}",
+                            engines[e].name,
+                            dcm_icc_transform_get_kernel_name(transform),
+                            output_types[o].name,
+                            planar ? "true" : "false",
+                            tile_size,
+                            megapixels);
+                    dcm_icc_transform_destroy(transform);
+                }
+            }
+        }
+    }
+}
+
+static void bench_threads(BenchOptions *options,
+                          const BenchProfile *profile,
+                          const uint8_t *frames[2],
+                          uint8_t *corrected_frame) {
+    for (size_t e = 0; e < COUNT(engines); e++) {
+        DcmIccTransformOptions transform_options;
+        create_options(&transform_options, DCM_ICC_OUTPUT_SRGB,
+                       engines[e].engine, engines[e].fast_paths,
+                       false);
+        DmcIccTransform *transform = dcm_icc_transform_create_with_options(
+            profile->data, profile->size,
+            BENCH_FRAME_SIZE, BENCH_FRAME_SIZE, &transform_options);
+        if (transform == NULL) {
+            continue;
+        }
+
+        for (uint32_t threads = 1; threads <= options->max_threads; threads *= 2) {
+            DcmIccThreadPool *pool = dcm_icc_thread_pool_create(threads);
+            if (pool == NULL) {
+                break;
+            }
+
+            const double megapixels = measure_throughput(options,
+                                                         transform,
+                                                         pool,
+                                                         frames[0],
+                                                         corrected_frame,
+                                                         BENCH_FRAME_SIZE);
+
+            begin_result(options, "threads");
+            fprintf(options->output,
+                    ", \"engine\": \"%s\", \"output_type\": \"srgb\""
+                    ", \"tile_size\": %u, \"threads\": %u"
+                    ", \"megapixels_per_second\": %.2f}",
+                    engines[e].name, BENCH_FRAME_SIZE,
+                    dcm_icc_thread_pool_get_number_of_threads(pool),
+                    megapixels);
+            dcm_icc_thread_pool_destroy(pool);
+        }
+        dcm_icc_transform_destroy(transform);
+    }
+}
+
+static void bench_accuracy(BenchOptions *options, const BenchProfile *profile) {
+    for (size_t e = 0; e < COUNT(engines); e++) {
+        for (size_t o = 0; o < COUNT(output_types); o++) {
+            DcmIccTransformOptions transform_options;
+            create_options(&transform_options, output_types[o].type,
+                           engines[e].engine, engines[e].fast_paths,
+                           false);
+
+            double max_delta_e = 0.0;
+            double mean_delta_e = 0.0;
+            if (!dcm_icc_transform_measure_accuracy(profile->data,
+                                                    profile->size,
+                                                    &transform_options,
+                                                    &max_delta_e,
+                                                    &mean_delta_e)) {
+                continue;
+            }
+
+            begin_result(options, "accuracy");
+            fprintf(options->output,
+                    ", \"engine\": \"%s\", \"output_type\": \"%s\""
+                    ", \"max_delta_e\": %.4f, \"mean_delta_e\": %.5f}",
+                    engines[e].name, output_types[o].name,
+                    max_delta_e, mean_delta_e);
+        }
+    }
+}
+
+static void usage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s [-t seconds] [-j threads] [-o output.json]\n"
+            "  -t  minimum time per throughput measurement (default 0.25)\n"
+            "  -j  maximum number of threads (default: online processors)\n"
+            "  -o  write JSON results to a file instead of stdout\n",
+            program);
+}
+
+int main(int argc, char *argv[]) {
+    BenchOptions options = {
+        .min_time = 0.25,
+        .max_threads = 0,
+        .output = stdout,
+        .first_result = true,
+    };
+    const char *output_path = NULL;
+    int option;
+
+    while ((option = getopt(argc, argv, "t:j:o:h")) != -1) {
+        switch (option) {
+            case 't':
+                options.min_time = atof(optarg);
+                break;
+            case 'j':
+                options.max_threads = (uint32_t)atoi(optarg);
+                break;
+            case 'o':
+                output_path = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return option == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (options.max_threads == 0) {
+        const long number_of_processors = sysconf(_SC_NPROCESSORS_ONLN);
+        options.max_threads = number_of_processors > 0 ? (uint32_t)number_of_processors : 1;
+    }
+
+    BenchProfile profile = { NULL, 0 };
+    if (!create_profile(&profile)) {
+        fprintf(stderr, "Error: Failed to create synthetic ICC profile\n");
+        return EXIT_FAILURE;
+    }
+
+    const size_t frame_size = (size_t)BENCH_FRAME_SIZE * BENCH_FRAME_SIZE * 3;
+    uint8_t *interleaved = malloc(frame_size);
+    uint8_t *planar = malloc(frame_size);
+    uint8_t *corrected_frame = malloc(frame_size);
+    if (interleaved == NULL || planar == NULL || corrected_frame == NULL) {
+        fprintf(stderr, "Error: Failed to allocate frames\n");
+        return EXIT_FAILURE;
+    }
+    fill_frame(interleaved, BENCH_FRAME_SIZE, false);
+    fill_frame(planar, BENCH_FRAME_SIZE, true);
+    const uint8_t *frames[2] = { interleaved, planar };
+
+    if (output_path != NULL) {
+        options.output = fopen(output_path, "w");
+        if (options.output == NULL) {
+            fprintf(stderr, "Error: Failed to open '%s'\n", output_path);
+            return EXIT_FAILURE;
+        }
+    }
+
+    fprintf(options.output,
+            "{\n  \"version\": \"%s\",\n  \"lcms_version\": %d,\n"
+            "  \"frame_size\": %u,\n  \"results\": [",
+            dcm_icc_get_version(), LCMS_VERSION, BENCH_FRAME_SIZE);
+    bench_creation(&options, &profile);
+    bench_throughput(&options, &profile, frames, corrected_frame);
+    bench_threads(&options, &profile, frames, corrected_frame);
+    bench_accuracy(&options, &profile);
+    fprintf(options.output, "\n  ]\n}\n");
+
+    if (options.output != stdout) {
+        fclose(options.output);
+    }
+    free(interleaved);
+    free(planar);
+    free(corrected_frame);
+    free(profile.data);
+
+    return EXIT_SUCCESS;
+}
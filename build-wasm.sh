@@ -2,19 +2,31 @@
 # Disable exit on non 0
 set -euo pipefail
 
-mkdir -p build
 mkdir -p dist
 
-# DEBUG CONFIGURE
-#(cd build && emcmake cmake -DCMAKE_BUILD_TYPE=Debug ..)
+# Variants: build directory and CMake options
+VARIANTS=(
+  "build|"
+  "build-simd|-DDICOMICC_WASM_SIMD=ON"
+  "build-mt|-DDICOMICC_WASM_THREADS=ON -DDICOMICC_WASM_SIMD=ON"
+)
 
-echo "~~~ CONFIGURE ~~~"
-(cd build && emcmake cmake ..)
-echo "~~~ MAKE ~~~"
-(cd build && emmake make)
-echo "~~~ COPY ~~~ "
-cp ./build/wasm/dicomiccwasm.js ./dist
-cp ./build/wasm/dicomiccwasm.wasm ./dist
+for variant in "${VARIANTS[@]}"; do
+  build_dir="${variant%%|*}"
+  options="${variant#*|}"
+  mkdir -p "${build_dir}"
+
+  # DEBUG CONFIGURE
+  #(cd "${build_dir}" && emcmake cmake -DCMAKE_BUILD_TYPE=Debug ${options} ..)
+
+  echo "~~~ CONFIGURE ${build_dir} ~~~"
+  (cd "${build_dir}" && emcmake cmake ${options} ..)
+  echo "~~~ MAKE ${build_dir} ~~~"
+  (cd "${build_dir}" && emmake make)
+  echo "~~~ COPY ${build_dir} ~~~ "
+  cp ./"${build_dir}"/wasm/dicomiccwasm*.js ./dist
+  cp ./"${build_dir}"/wasm/dicomiccwasm*.wasm ./dist
+done
 
 echo "~~~ BUILD:"
 (cd build && ls)
@@ -36,16 +36,67 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
-    dcm_log_info("Get ICC profile");
-    DcmElement *optical_path_element = dcm_dataset_get(metadata, 0x00480105);
-    DcmSequence *optical_path_seq = dcm_element_get_value_SQ(optical_path_element);
-    DcmDataSet *optical_path_item = dcm_sequence_get(optical_path_seq, 0);
-    DcmElement *icc_profile_element = dcm_dataset_get(optical_path_item,
-                                                      0x00282000);
-    uint32_t icc_profile_length = dcm_element_get_length(icc_profile_element);
-    const char *icc_profile = dcm_element_get_value_OB(icc_profile_element);
     DcmElement *planar_config_element = dcm_dataset_get(metadata, 0x00280006);
     uint8_t planar_config = dcm_element_get_value_US(planar_config_element, 0);
+    DcmElement *rows_element = dcm_dataset_get(metadata, 0x00280010);
+    DcmElement *columns_element = dcm_dataset_get(metadata, 0x00280011);
+    uint16_t rows = dcm_element_get_value_US(rows_element, 0);
+    uint16_t columns = dcm_element_get_value_US(columns_element, 0);
+
+    dcm_log_info("Create ICC transforms of the optical paths.");
+    DcmIccTransformOptions options;
+    dcm_icc_transform_options_init(&options);
+    options.planar_configuration = planar_config;
+    DcmIccTransformSet *transform_set = dcm_icc_transform_set_create(columns,
+                                                                     rows,
+                                                                     &options);
+    if (transform_set == NULL) {
+        dcm_log_error("Failed to create the transform set.");
+        dcm_dataset_destroy(metadata);
+        dcm_file_destroy(file);
+        return EXIT_FAILURE;
+    }
+
+    // Every item of the Optical Path Sequence may carry its own ICC profile,
+    // optical paths with identical profiles share a transform
+    DcmElement *optical_path_element = dcm_dataset_get(metadata, 0x00480105);
+    DcmSequence *optical_path_seq = dcm_element_get_value_SQ(optical_path_element);
+    uint32_t number_of_optical_paths = dcm_sequence_count(optical_path_seq);
+    for (uint32_t i = 0; i < number_of_optical_paths; i++) {
+        DcmDataSet *optical_path_item = dcm_sequence_get(optical_path_seq, i);
+        DcmElement *icc_profile_element = dcm_dataset_get(optical_path_item,
+                                                          0x00282000);
+        const char *icc_profile = NULL;
+        uint32_t icc_profile_length = 0;
+        if (icc_profile_element != NULL) {
+            icc_profile = dcm_element_get_value_OB(icc_profile_element);
+            icc_profile_length = dcm_element_get_length(icc_profile_element);
+        }
+        if (dcm_icc_transform_set_add(transform_set,
+                                      icc_profile,
+                                      icc_profile_length) < 0) {
+            dcm_log_error("Failed to create the transform of optical path #%u.", i);
+            dcm_icc_transform_set_destroy(transform_set);
+            dcm_dataset_destroy(metadata);
+            dcm_file_destroy(file);
+            return EXIT_FAILURE;
+        }
+    }
+    dcm_log_info("Created %u transforms for %u optical paths.",
+                 dcm_icc_transform_set_get_number_of_transforms(transform_set),
+                 number_of_optical_paths);
+
+    // Frames of TILED_FULL images are ordered by optical path last
+    DcmElement *number_of_frames_element = dcm_dataset_get(metadata, 0x00280008);
+    uint32_t number_of_frames = 1;
+    if (number_of_frames_element != NULL) {
+        number_of_frames = (uint32_t)dcm_element_get_value_IS(number_of_frames_element, 0);
+    }
+    uint32_t optical_path_index = 0;
+    if (number_of_optical_paths > 1 && number_of_frames >= number_of_optical_paths) {
+        optical_path_index = (frame_number - 1) /
+                             (number_of_frames / number_of_optical_paths);
+    }
 
     dcm_log_info("Read frame #%u from DICOM file.", frame_number);
     DcmBOT *bot = dcm_file_build_bot(file, metadata);
@@ -55,21 +106,13 @@ int main(int argc, char *argv[])
                       "Could not read frame #%u.",
                       file_path, frame_number);
         dcm_bot_destroy(bot);
+        dcm_icc_transform_set_destroy(transform_set);
         dcm_dataset_destroy(metadata);
         dcm_file_destroy(file);
         return EXIT_FAILURE;
     }
     const char *frame_value = dcm_frame_get_value(frame);
     uint32_t frame_length = dcm_frame_get_length(frame);
-    uint16_t columns = dcm_frame_get_columns(frame);
-    uint16_t rows = dcm_frame_get_rows(frame);
-
-    dcm_log_info("Create ICC transform.");
-    DmcIccTransform *icc_transform = dcm_icc_transform_create(icc_profile,
-                                                              icc_profile_length,
-                                                              planar_config,
-                                                              columns,
-                                                              rows);
 
     char *corrected_frame_value = malloc(frame_length);
     //this should be frame_length+1, but in this case we will have memory leaks
@@ -77,16 +120,21 @@ int main(int argc, char *argv[])
         dcm_log_error("Failed to allocate memory for frame buffer.");
         dcm_bot_destroy(bot);
         dcm_frame_destroy(frame);
+        dcm_icc_transform_set_destroy(transform_set);
         dcm_dataset_destroy(metadata);
         dcm_file_destroy(file);
         return EXIT_FAILURE;
     }
 
-    dcm_log_info("Apply ICC transform to frame #%u", frame_number);
-    dcm_icc_transform_apply(icc_transform,
-                            frame_value,
-                            frame_length,
-                            corrected_frame_value);
+    dcm_log_info("Apply ICC transform of optical path #%u to frame #%u",
+                 optical_path_index, frame_number);
+    if (!dcm_icc_transform_set_apply(transform_set,
+                                     optical_path_index,
+                                     frame_value,
+                                     frame_length,
+                                     corrected_frame_value)) {
+        dcm_log_warning("Optical path #%u has no ICC profile.", optical_path_index);
+    }
 
     dcm_log_info("Cleanup DICOM bot.");
     dcm_bot_destroy(bot);
@@ -97,8 +145,8 @@ int main(int argc, char *argv[])
     dcm_log_info("Cleanup DICOM file.");
     dcm_file_destroy(file);
 
-    dcm_log_info("Cleanup ICC transform.");
-    dcm_icc_transform_destroy(icc_transform);
+    dcm_log_info("Cleanup ICC transforms.");
+    dcm_icc_transform_set_destroy(transform_set);
 
     dcm_log_info("Cleanup output image.");
     free(corrected_frame_value);
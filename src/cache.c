@@ -0,0 +1,312 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "dicomicc.h"
+#include "pipeline.h"
+#include "context.h"
+
+// Number of hash buckets, must be a power of two
+#define DCM_ICC_CACHE_BUCKETS 256
+
+typedef struct _DcmIccCacheEntry DcmIccCacheEntry;
+
+struct _DcmIccCacheEntry {
+    DcmIccPipeline *pipeline;
+    char *icc_profile;
+    size_t size;
+    DcmIccCacheEntry *bucket_next;
+    DcmIccCacheEntry *lru_previous;
+    DcmIccCacheEntry *lru_next;
+};
+
+/**
+ * Cache of pipelines. Entries are kept in a list ordered by last use and the
+ * least recently used ones are evicted once the total size exceeds the
+ * capacity. Transforms hold their own pipeline references, so eviction never
+ * invalidates a transform in use.
+ */
+struct _DcmIccCache {
+    // Context whose allocator allocates the entries, NULL for malloc()
+    const DcmIccContext *context;
+    pthread_mutex_t mutex;
+    DcmIccCacheEntry *buckets[DCM_ICC_CACHE_BUCKETS];
+    DcmIccCacheEntry *lru_head;
+    DcmIccCacheEntry *lru_tail;
+    size_t size;
+    size_t capacity;
+};
+
+// Cache of transforms created without a context
+static DcmIccCache process_cache = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .capacity = DCM_ICC_CACHE_DEFAULT_CAPACITY,
+};
+
+// Directory of table files shared across processes, NULL if unset
+static struct {
+    pthread_mutex_t mutex;
+    char *directory;
+} files = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static uint32_t bucket_index(const DcmIccPipelineKey *key) {
+    uint64_t hash = key->profile_hash;
+
+    hash ^= (uint64_t)key->output_type * UINT64_C(0x9e3779b97f4a7c15);
+    hash ^= key->output_profile_hash;
+    hash ^= (uint64_t)key->intent * UINT64_C(0xc2b2ae3d27d4eb4f);
+    hash ^= (uint64_t)key->input_format * UINT64_C(0x165667b19e3779f9);
+    hash ^= (uint64_t)key->output_format * UINT64_C(0x27d4eb2f165667c5);
+    hash ^= (uint64_t)key->flags * UINT64_C(0xd6e8feb86659fd93);
+    hash ^= (uint64_t)key->engine * UINT64_C(0x94d049bb133111eb);
+    hash ^= (uint64_t)key->lut_grid_points * UINT64_C(0xbf58476d1ce4e5b9);
+    hash ^= hash >> 32;
+
+    return (uint32_t)hash & (DCM_ICC_CACHE_BUCKETS - 1);
+}
+
+static bool key_equal(const DcmIccPipelineKey *a, const DcmIccPipelineKey *b) {
+    return a->profile_hash == b->profile_hash &&
+           a->profile_size == b->profile_size &&
+           a->output_type == b->output_type &&
+           a->output_profile_hash == b->output_profile_hash &&
+           a->intent == b->intent &&
+           a->input_format == b->input_format &&
+           a->output_format == b->output_format &&
+           a->flags == b->flags &&
+           a->engine == b->engine &&
+           a->lut_grid_points == b->lut_grid_points &&
+           a->fast_paths == b->fast_paths;
+}
+
+/**
+ * Find an entry, verifying the profile bytes to rule out hash collisions.
+ * Must be called with the cache mutex held.
+ */
+static DcmIccCacheEntry *find_entry(DcmIccCache *cache,
+                                    const DcmIccPipelineKey *key,
+                                    const char *icc_profile) {
+    DcmIccCacheEntry *entry = cache->buckets[bucket_index(key)];
+
+    while (entry != NULL) {
+        if (key_equal(&entry->pipeline->key, key) &&
+            memcmp(entry->icc_profile, icc_profile, key->profile_size) == 0) {
+            return entry;
+        }
+        entry = entry->bucket_next;
+    }
+
+    return NULL;
+}
+
+static void lru_unlink(DcmIccCache *cache, DcmIccCacheEntry *entry) {
+    if (entry->lru_previous) {
+        entry->lru_previous->lru_next = entry->lru_next;
+    } else {
+        cache->lru_head = entry->lru_next;
+    }
+    if (entry->lru_next) {
+        entry->lru_next->lru_previous = entry->lru_previous;
+    } else {
+        cache->lru_tail = entry->lru_previous;
+    }
+    entry->lru_previous = NULL;
+    entry->lru_next = NULL;
+}
+
+static void lru_push_front(DcmIccCache *cache, DcmIccCacheEntry *entry) {
+    entry->lru_previous = NULL;
+    entry->lru_next = cache->lru_head;
+    if (cache->lru_head) {
+        cache->lru_head->lru_previous = entry;
+    } else {
+        cache->lru_tail = entry;
+    }
+    cache->lru_head = entry;
+}
+
+static void remove_entry(DcmIccCache *cache, DcmIccCacheEntry *entry) {
+    DcmIccCacheEntry **link = &cache->buckets[bucket_index(&entry->pipeline->key)];
+
+    while (*link != entry) {
+        link = &(*link)->bucket_next;
+    }
+    *link = entry->bucket_next;
+
+    lru_unlink(cache, entry);
+    cache->size -= entry->size;
+
+    dcm_icc_pipeline_release(entry->pipeline);
+    dcm_icc_free(cache->context, entry->icc_profile);
+    dcm_icc_free(cache->context, entry);
+}
+
+static void evict(DcmIccCache *cache, size_t capacity) {
+    while (cache->size > capacity && cache->lru_tail != NULL) {
+        remove_entry(cache, cache->lru_tail);
+    }
+}
+
+DcmIccCache *dcm_icc_cache_create(const DcmIccContext *context, size_t capacity) {
+    DcmIccCache *cache = dcm_icc_calloc(context, 1, sizeof(DcmIccCache));
+    if (cache == NULL) {
+        return NULL;
+    }
+
+    cache->context = context;
+    pthread_mutex_init(&cache->mutex, NULL);
+    cache->capacity = capacity;
+
+    return cache;
+}
+
+void dcm_icc_cache_destroy(DcmIccCache *cache) {
+    if (cache) {
+        evict(cache, 0);
+        pthread_mutex_destroy(&cache->mutex);
+        dcm_icc_free(cache->context, cache);
+    }
+}
+
+DcmIccPipeline *dcm_icc_cache_lookup(DcmIccCache *cache,
+                                     const DcmIccPipelineKey *key,
+                                     const char *icc_profile) {
+    DcmIccPipeline *pipeline = NULL;
+
+    if (cache == NULL) {
+        cache = &process_cache;
+    }
+
+    pthread_mutex_lock(&cache->mutex);
+    DcmIccCacheEntry *entry = find_entry(cache, key, icc_profile);
+    if (entry != NULL) {
+        lru_unlink(cache, entry);
+        lru_push_front(cache, entry);
+        pipeline = dcm_icc_pipeline_retain(entry->pipeline);
+    }
+    pthread_mutex_unlock(&cache->mutex);
+
+    return pipeline;
+}
+
+DcmIccPipeline *dcm_icc_cache_insert(DcmIccCache *cache,
+                                     DcmIccPipeline *pipeline,
+                                     const char *icc_profile) {
+    const DcmIccPipelineKey *key = &pipeline->key;
+    const size_t size = pipeline->size + key->profile_size;
+    DcmIccPipeline *cached = NULL;
+
+    if (cache == NULL) {
+        cache = &process_cache;
+    }
+
+    pthread_mutex_lock(&cache->mutex);
+
+    DcmIccCacheEntry *entry = find_entry(cache, key, icc_profile);
+    if (entry != NULL) {
+        // Lost a race against another thread creating the same pipeline
+        lru_unlink(cache, entry);
+        lru_push_front(cache, entry);
+        cached = dcm_icc_pipeline_retain(entry->pipeline);
+        pthread_mutex_unlock(&cache->mutex);
+        return cached;
+    }
+
+    if (size > cache->capacity) {
+        pthread_mutex_unlock(&cache->mutex);
+        return dcm_icc_pipeline_retain(pipeline);
+    }
+
+    entry = dcm_icc_calloc(cache->context, 1, sizeof(DcmIccCacheEntry));
+    char *profile_copy = dcm_icc_malloc(cache->context, key->profile_size);
+    if (entry == NULL || profile_copy == NULL) {
+        pthread_mutex_unlock(&cache->mutex);
+        dcm_icc_free(cache->context, entry);
+        dcm_icc_free(cache->context, profile_copy);
+        return dcm_icc_pipeline_retain(pipeline);
+    }
+    memcpy(profile_copy, icc_profile, key->profile_size);
+
+    entry->pipeline = dcm_icc_pipeline_retain(pipeline);
+    entry->icc_profile = profile_copy;
+    entry->size = size;
+
+    const uint32_t index = bucket_index(key);
+    entry->bucket_next = cache->buckets[index];
+    cache->buckets[index] = entry;
+    lru_push_front(cache, entry);
+    cache->size += size;
+
+    evict(cache, cache->capacity);
+
+    pthread_mutex_unlock(&cache->mutex);
+
+    return dcm_icc_pipeline_retain(pipeline);
+}
+
+void dcm_icc_transform_cache_set_capacity(size_t capacity) {
+    pthread_mutex_lock(&process_cache.mutex);
+    process_cache.capacity = capacity;
+    evict(&process_cache, capacity);
+    pthread_mutex_unlock(&process_cache.mutex);
+}
+
+size_t dcm_icc_transform_cache_get_capacity(void) {
+    pthread_mutex_lock(&process_cache.mutex);
+    size_t capacity = process_cache.capacity;
+    pthread_mutex_unlock(&process_cache.mutex);
+
+    return capacity;
+}
+
+size_t dcm_icc_transform_cache_get_size(void) {
+    pthread_mutex_lock(&process_cache.mutex);
+    size_t size = process_cache.size;
+    pthread_mutex_unlock(&process_cache.mutex);
+
+    return size;
+}
+
+void dcm_icc_transform_cache_clear(void) {
+    pthread_mutex_lock(&process_cache.mutex);
+    evict(&process_cache, 0);
+    pthread_mutex_unlock(&process_cache.mutex);
+}
+
+bool dcm_icc_transform_cache_set_directory(const char *directory) {
+    char *copy = NULL;
+    if (directory != NULL) {
+        copy = strdup(directory);
+        if (copy == NULL) {
+            return false;
+        }
+    }
+
+    pthread_mutex_lock(&files.mutex);
+    free(files.directory);
+    files.directory = copy;
+    pthread_mutex_unlock(&files.mutex);
+
+    return true;
+}
+
+char *dcm_icc_cache_get_file_path(const char *name) {
+    char *path = NULL;
+
+    pthread_mutex_lock(&files.mutex);
+    if (files.directory != NULL) {
+        const size_t size = strlen(files.directory) + strlen(name) + 2;
+        path = malloc(size);
+        if (path != NULL) {
+            snprintf(path, size, "%s/%s", files.directory, name);
+        }
+    }
+    pthread_mutex_unlock(&files.mutex);
+
+    return path;
+}
@@ -0,0 +1,216 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdio.h>
+#include <lcms2.h>
+
+#include "dicomicc.h"
+#include "pipeline.h"
+#include "context.h"
+#include "stats.h"
+
+// Longest error message passed to an error callback
+#define DCM_ICC_MAX_ERROR_SIZE 512
+
+static void *default_malloc(void *user_data, size_t size) {
+    (void)user_data;
+    return malloc(size);
+}
+
+static void *default_realloc(void *user_data, void *pointer, size_t size) {
+    (void)user_data;
+    return realloc(pointer, size);
+}
+
+static void default_free(void *user_data, void *pointer) {
+    (void)user_data;
+    free(pointer);
+}
+
+static void *lcms_malloc(cmsContext lcms_context, cmsUInt32Number size) {
+    const DcmIccContext *context = cmsGetContextUserData(lcms_context);
+
+    return context->allocator.malloc(context->allocator.user_data, size);
+}
+
+static void *lcms_realloc(cmsContext lcms_context, void *pointer, cmsUInt32Number size) {
+    const DcmIccContext *context = cmsGetContextUserData(lcms_context);
+
+    return context->allocator.realloc(context->allocator.user_data, pointer, size);
+}
+
+static void lcms_free(cmsContext lcms_context, void *pointer) {
+    const DcmIccContext *context = cmsGetContextUserData(lcms_context);
+
+    context->allocator.free(context->allocator.user_data, pointer);
+}
+
+/**
+ * Routes the allocations of an lcms2 context to the allocator of the
+ * DcmIccContext passed as user data. The block of the lcms2 context itself
+ * is allocated before the plugin is installed and comes from malloc().
+ */
+static cmsPluginMemHandler memory_plugin = {
+    .base = {
+        .Magic = cmsPluginMagicNumber,
+        .ExpectedVersion = 2060,
+        .Type = cmsPluginMemHandlerSig,
+        .Next = NULL,
+    },
+    .MallocPtr = lcms_malloc,
+    .FreePtr = lcms_free,
+    .ReallocPtr = lcms_realloc,
+};
+
+/**
+ * Forward lcms2 errors to the error callback of the context
+ */
+static void handle_lcms_error(cmsContext lcms_context,
+                              cmsUInt32Number code,
+                              const char *text) {
+    const DcmIccContext *context = cmsGetContextUserData(lcms_context);
+
+    dcm_icc_error(context, "%s (lcms2 error %u)", text, (uint32_t)code);
+}
+
+void dcm_icc_context_options_init(DcmIccContextOptions *options) {
+    options->error_callback = NULL;
+    options->user_data = NULL;
+    options->cache_capacity = DCM_ICC_CACHE_DEFAULT_CAPACITY;
+    options->allocator = NULL;
+    options->collect_stats = false;
+}
+
+DcmIccContext *dcm_icc_context_create(const DcmIccContextOptions *options) {
+    DcmIccAllocator allocator = {
+        .malloc = default_malloc,
+        .realloc = default_realloc,
+        .free = default_free,
+        .user_data = NULL,
+    };
+
+    if (options->allocator != NULL) {
+        if (options->allocator->malloc == NULL ||
+            options->allocator->realloc == NULL ||
+            options->allocator->free == NULL) {
+            dcm_icc_error(NULL, "Allocators require malloc, realloc and free functions");
+            return NULL;
+        }
+        allocator = *options->allocator;
+    }
+
+    DcmIccContext *context = allocator.malloc(allocator.user_data, sizeof(DcmIccContext));
+    if (context == NULL) {
+        return NULL;
+    }
+    memset(context, 0, sizeof(DcmIccContext));
+
+    context->allocator = allocator;
+    context->error_callback = options->error_callback;
+    context->user_data = options->user_data;
+    context->cache = dcm_icc_cache_create(context, options->cache_capacity);
+    context->lcms_context = cmsCreateContext(&memory_plugin, context);
+    if (options->collect_stats) {
+        context->stats = dcm_icc_stats_create(context);
+    }
+    if (context->cache == NULL || context->lcms_context == NULL ||
+        (options->collect_stats && context->stats == NULL)) {
+        dcm_icc_context_destroy(context);
+        return NULL;
+    }
+    cmsSetLogErrorHandlerTHR(context->lcms_context, handle_lcms_error);
+
+    return context;
+}
+
+void dcm_icc_context_destroy(DcmIccContext *context) {
+    if (context) {
+        // Cached pipelines are released first, they belong to the lcms2 context
+        dcm_icc_cache_destroy(context->cache);
+        if (context->lcms_context) {
+            cmsDeleteContext(context->lcms_context);
+        }
+        dcm_icc_stats_destroy(context, context->stats);
+        context->allocator.free(context->allocator.user_data, context);
+    }
+}
+
+cmsContext dcm_icc_context_get_lcms_context(const DcmIccContext *context) {
+    return context ? context->lcms_context : NULL;
+}
+
+bool dcm_icc_context_get_stats(const DcmIccContext *context,
+                               DcmIccStats *stats) {
+    if (context == NULL || context->stats == NULL) {
+        return false;
+    }
+    dcm_icc_stats_snapshot(context->stats, stats);
+    return true;
+}
+
+void dcm_icc_context_reset_stats(DcmIccContext *context) {
+    if (context != NULL && context->stats != NULL) {
+        dcm_icc_stats_reset(context->stats);
+    }
+}
+
+DcmIccCache *dcm_icc_context_get_cache(const DcmIccContext *context) {
+    return context ? context->cache : NULL;
+}
+
+void *dcm_icc_malloc(const DcmIccContext *context, size_t size) {
+    if (context == NULL) {
+        return malloc(size);
+    }
+    return context->allocator.malloc(context->allocator.user_data, size);
+}
+
+void *dcm_icc_calloc(const DcmIccContext *context, size_t count, size_t size) {
+    if (context == NULL) {
+        return calloc(count, size);
+    }
+    if (size != 0 && count > SIZE_MAX / size) {
+        return NULL;
+    }
+
+    void *pointer = context->allocator.malloc(context->allocator.user_data, count * size);
+    if (pointer != NULL) {
+        memset(pointer, 0, count * size);
+    }
+
+    return pointer;
+}
+
+void *dcm_icc_realloc(const DcmIccContext *context, void *pointer, size_t size) {
+    if (context == NULL) {
+        return realloc(pointer, size);
+    }
+    return context->allocator.realloc(context->allocator.user_data, pointer, size);
+}
+
+void dcm_icc_free(const DcmIccContext *context, void *pointer) {
+    if (context == NULL) {
+        free(pointer);
+    } else if (pointer != NULL) {
+        context->allocator.free(context->allocator.user_data, pointer);
+    }
+}
+
+void dcm_icc_error(const DcmIccContext *context, const char *format, ...) {
+    char message[DCM_ICC_MAX_ERROR_SIZE];
+    va_list arguments;
+
+    va_start(arguments, format);
+    vsnprintf(message, sizeof(message), format, arguments);
+    va_end(arguments);
+
+    if (context != NULL && context->stats != NULL) {
+        dcm_icc_stats_record_error(context->stats);
+    }
+    if (context != NULL && context->error_callback != NULL) {
+        context->error_callback(context->user_data, message);
+    } else {
+        fprintf(stderr, "Error: %s\n", message);
+    }
+}
@@ -0,0 +1,56 @@
+#include <stdarg.h>
+#include <lcms2.h>
+
+#include "dicomicc.h"
+#include "pipeline.h"
+#include "stats.h"
+
+#ifndef DCM_ICC_CONTEXT_INCLUDED
+#define DCM_ICC_CONTEXT_INCLUDED
+
+/**
+ * Dedicated lcms2 context, pipeline cache and error callback, so that
+ * transforms of different contexts share no mutable state.
+ */
+struct _DcmIccContext {
+    DcmIccAllocator allocator;
+    cmsContext lcms_context;
+    DcmIccCache *cache;
+    DcmIccErrorCallback error_callback;
+    void *user_data;
+    // Counters of all transforms of the context, NULL unless collected
+    DcmIccStatsCounters *stats;
+};
+
+/**
+ * lcms2 context of a context, NULL (the global lcms2 context) if context is
+ * NULL
+ */
+cmsContext dcm_icc_context_get_lcms_context(const DcmIccContext *context);
+
+/**
+ * Pipeline cache of a context, NULL (the process-wide cache) if context is
+ * NULL
+ */
+DcmIccCache *dcm_icc_context_get_cache(const DcmIccContext *context);
+
+/**
+ * Allocate memory with the allocator of a context, or with malloc() if
+ * context is NULL
+ */
+void *dcm_icc_malloc(const DcmIccContext *context, size_t size);
+
+void *dcm_icc_calloc(const DcmIccContext *context, size_t count, size_t size);
+
+void *dcm_icc_realloc(const DcmIccContext *context, void *pointer, size_t size);
+
+void dcm_icc_free(const DcmIccContext *context, void *pointer);
+
+/**
+ * Report an error to the callback of a context, or to stderr if there is
+ * none
+ */
+void dcm_icc_error(const DcmIccContext *context, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+#endif
@@ -1,17 +1,105 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
 #include <math.h>
 #include <lcms2.h>
 
 #include "dicomicc.h"
+#include "threadpool.h"
+#include "pipeline.h"
+#include "lut3d.h"
+#include "lut24.h"
+#include "shaper.h"
+#include "downsample.h"
+#include "ybr.h"
+#include "transform.h"
+#include "profiles.h"
+#include "context.h"
+#include "stats.h"
 #include "config.h"
 
-struct _DmcIccTransform {
-    cmsHTRANSFORM handle;
-    uint32_t number_of_pixels;
+// Stripes smaller than this are not worth handing to another thread
+#define DCM_ICC_MIN_PIXELS_PER_STRIPE 16384
+
+// Number of stripes per worker thread, to balance uneven progress of workers
+#define DCM_ICC_STRIPES_PER_THREAD 4
+
+// Lattice points per axis of the 8-bit RGB colours used to measure accuracy
+#define DCM_ICC_ACCURACY_LATTICE_POINTS 65
+
+static const DcmIccFormatInfo format_infos[] = {
+    [DCM_ICC_FORMAT_RGB_8] = {
+        TYPE_RGB_8, DCM_ICC_SAMPLE_UNSIGNED, 1, 3, false, { 0, 1, 2, 3 }
+    },
+    [DCM_ICC_FORMAT_RGB_16] = {
+        TYPE_RGB_16, DCM_ICC_SAMPLE_UNSIGNED, 2, 3, false, { 0, 1, 2, 3 }
+    },
+    [DCM_ICC_FORMAT_RGB_HALF] = {
+        TYPE_RGB_HALF_FLT, DCM_ICC_SAMPLE_HALF, 2, 3, false, { 0, 1, 2, 3 }
+    },
+    [DCM_ICC_FORMAT_RGB_FLOAT] = {
+        TYPE_RGB_FLT, DCM_ICC_SAMPLE_FLOAT, 4, 3, false, { 0, 1, 2, 3 }
+    },
+    [DCM_ICC_FORMAT_RGBA_8] = {
+        TYPE_RGBA_8, DCM_ICC_SAMPLE_UNSIGNED, 1, 4, true, { 0, 1, 2, 3 }
+    },
+    [DCM_ICC_FORMAT_RGBA_16] = {
+        TYPE_RGBA_16, DCM_ICC_SAMPLE_UNSIGNED, 2, 4, true, { 0, 1, 2, 3 }
+    },
+    [DCM_ICC_FORMAT_RGBA_HALF] = {
+        TYPE_RGBA_HALF_FLT, DCM_ICC_SAMPLE_HALF, 2, 4, true, { 0, 1, 2, 3 }
+    },
+    [DCM_ICC_FORMAT_RGBA_FLOAT] = {
+        TYPE_RGBA_FLT, DCM_ICC_SAMPLE_FLOAT, 4, 4, true, { 0, 1, 2, 3 }
+    },
+    // Padding is an extra channel that is neither read nor written
+    [DCM_ICC_FORMAT_RGBX_8] = {
+        TYPE_RGBA_8, DCM_ICC_SAMPLE_UNSIGNED, 1, 4, false, { 0, 1, 2, 3 }
+    },
+    [DCM_ICC_FORMAT_RGBX_16] = {
+        TYPE_RGBA_16, DCM_ICC_SAMPLE_UNSIGNED, 2, 4, false, { 0, 1, 2, 3 }
+    },
+    [DCM_ICC_FORMAT_BGRA_8] = {
+        TYPE_BGRA_8, DCM_ICC_SAMPLE_UNSIGNED, 1, 4, true, { 2, 1, 0, 3 }
+    },
+    [DCM_ICC_FORMAT_ARGB_8] = {
+        TYPE_ARGB_8, DCM_ICC_SAMPLE_UNSIGNED, 1, 4, true, { 1, 2, 3, 0 }
+    },
+    [DCM_ICC_FORMAT_YBR_FULL_8] = {
+        TYPE_YCbCr_8, DCM_ICC_SAMPLE_UNSIGNED, 1, 3, false, { 0, 1, 2, 3 }, true, false
+    },
+    // Four samples per pixel pair, i.e. two bytes per pixel
+    [DCM_ICC_FORMAT_YBR_FULL_422_8] = {
+        TYPE_YCbCr_8, DCM_ICC_SAMPLE_UNSIGNED, 1, 2, false, { 0, 1, 2, 3 }, true, true
+    },
 };
 
+// Pixels of YBR input converted at a time, on the stack
+#define DCM_ICC_YBR_CHUNK_PIXELS 256
+
+typedef struct {
+    const DmcIccTransform *icc_transform;
+    const char *frame;
+    char *corrected_frame;
+    uint32_t rows_per_stripe;
+} DcmIccStripeJob;
+
+// Contiguous rows of an item of a batch
+typedef struct {
+    uint32_t item;
+    uint32_t first_row;
+    uint32_t number_of_rows;
+} DcmIccBatchUnit;
+
+typedef struct {
+    const DmcIccTransform *icc_transform;
+    const DcmIccBatchItem *items;
+    const DcmIccBatchUnit *units;
+} DcmIccBatchJob;
+
 const char *dcm_icc_get_version(void) {
     return DCMICC_VERSION;
 }
@@ -232,79 +320,554 @@ cmsHPROFILE create_romm_rgb_profile(void) {
     return profile;
 }
 
-DmcIccTransform *dcm_icc_transform_create_for_output(const char *icc_profile,
-                                                     uint32_t icc_profile_size,
-                                                     uint8_t planar_configuration,
-                                                     uint16_t columns,
-                                                     uint16_t rows,
-                                                     DcmIccOutputType output_type) {
-    cmsUInt32Number type;
+static const DcmIccFormatInfo *get_format_info(DcmIccPixelFormat format) {
+    if ((uint32_t)format >= sizeof(format_infos) / sizeof(format_infos[0])) {
+        return NULL;
+    }
+    return &format_infos[format];
+}
 
-    // Input ICC profile: obtained from DICOM data set
-    const cmsHPROFILE in_handle = cmsOpenProfileFromMem(icc_profile,
-                                                        icc_profile_size);
-    cmsHPROFILE out_handle = NULL;
+uint32_t dcm_icc_pixel_format_get_size(DcmIccPixelFormat format) {
+    const DcmIccFormatInfo *info = get_format_info(format);
+    if (info == NULL) {
+        return 0;
+    }
+    return (uint32_t)info->bytes_per_sample * info->samples_per_pixel;
+}
 
-    if (in_handle == NULL) {
-        return NULL;
+DcmIccBufferLayout dcm_icc_frame_layout(const DcmIccFormatInfo *format,
+                                        uint32_t columns,
+                                        size_t number_of_pixels,
+                                        bool planar) {
+    DcmIccBufferLayout layout;
+
+    if (planar) {
+        layout.row_stride = (size_t)columns * format->bytes_per_sample;
+        layout.plane_stride = number_of_pixels * format->bytes_per_sample;
+    } else {
+        layout.row_stride = (size_t)columns * format->bytes_per_sample *
+                            format->samples_per_pixel;
+        layout.plane_stride = 0;
     }
 
-    switch (output_type) {
-        case DCM_ICC_OUTPUT_SRGB:
-            out_handle = create_srgb_profile();
-            break;
-        case DCM_ICC_OUTPUT_DISPLAY_P3:
-            out_handle = create_display_p3_profile();
-            break;
-        case DCM_ICC_OUTPUT_ADOBE_RGB:
-            out_handle = create_adobe_rgb_profile();
+    return layout;
+}
+
+/**
+ * Encode a value in [0, 1] as a sample of a format
+ */
+static void encode_sample(const DcmIccFormatInfo *format,
+                          float value,
+                          uint8_t sample[4]) {
+    if (!(value > 0.0f)) {
+        value = 0.0f;
+    } else if (value > 1.0f) {
+        value = 1.0f;
+    }
+
+    memset(sample, 0, 4);
+    switch (format->sample_type) {
+        case DCM_ICC_SAMPLE_HALF: {
+            // Normalised half float, values below 2^-14 are flushed to zero
+            uint16_t half = 0;
+            if (value >= 1.0f / 16384.0f) {
+                int exponent;
+                const float mantissa = frexpf(value, &exponent);
+                uint32_t bits = (uint32_t)lrintf((mantissa * 2.0f - 1.0f) * 1024.0f);
+                exponent += 14;
+                if (bits == 1024) {
+                    bits = 0;
+                    exponent++;
+                }
+                half = (uint16_t)(exponent << 10 | bits);
+            }
+            memcpy(sample, &half, sizeof(half));
             break;
-        case DCM_ICC_OUTPUT_ROMM_RGB:
-            out_handle = create_romm_rgb_profile();
+        }
+        case DCM_ICC_SAMPLE_FLOAT:
+            memcpy(sample, &value, sizeof(value));
             break;
         default:
-            cmsCloseProfile(in_handle);
+            if (format->bytes_per_sample == 1) {
+                sample[0] = (uint8_t)lrintf(value * 255.0f);
+            } else {
+                const uint16_t unsigned_value = (uint16_t)lrintf(value * 65535.0f);
+                memcpy(sample, &unsigned_value, sizeof(unsigned_value));
+            }
+            break;
+    }
+}
+
+/**
+ * Key identifying the table file of a pipeline
+ */
+static DcmIccLutFileKey lut_file_key(const DcmIccPipelineKey *key) {
+    DcmIccLutFileKey file_key;
+
+    memset(&file_key, 0, sizeof(file_key));
+    file_key.profile_hash = key->profile_hash;
+    file_key.profile_size = key->profile_size;
+    file_key.output_type = (uint32_t)key->output_type;
+    file_key.output_profile_hash = key->output_profile_hash;
+    file_key.intent = key->intent;
+    file_key.input_format = key->input_format;
+    file_key.lut_grid_points = key->lut_grid_points;
+
+    return file_key;
+}
+
+/**
+ * Table file of a pipeline: the file given in the options, or else a file in
+ * the cache directory named after the key. Returns NULL for lcms2 pipelines
+ * and if there is no such file.
+ */
+static char *lut_file_path(const DcmIccPipelineKey *key,
+                           const DcmIccLutFileKey *file_key,
+                           const DcmIccTransformOptions *options) {
+    if (key->engine == DCM_ICC_ENGINE_LUT24 && options->lut_path != NULL) {
+        return strdup(options->lut_path);
+    }
+    if (key->engine != DCM_ICC_ENGINE_LUT24 && key->engine != DCM_ICC_ENGINE_LUT3D) {
+        return NULL;
+    }
+
+    char name[32];
+    snprintf(name, sizeof(name), "%016" PRIx64 ".%s",
+             dcm_icc_hash(file_key, sizeof(DcmIccLutFileKey)),
+             key->engine == DCM_ICC_ENGINE_LUT24 ? "lut24" : "lut3d");
+
+    return dcm_icc_cache_get_file_path(name);
+}
+
+static DcmIccPipeline *create_lut24_pipeline(const DcmIccContext *context,
+                                             const DcmIccPipelineKey *key,
+                                             DcmIccLut24 *lut24) {
+    DcmIccPipeline *pipeline = dcm_icc_pipeline_create(context, key, NULL);
+    if (pipeline == NULL) {
+        dcm_icc_lut24_destroy(lut24);
+        return NULL;
+    }
+
+    pipeline->lut24 = lut24;
+    pipeline->size += lut24->size;
+
+    return pipeline;
+}
+
+static DcmIccPipeline *create_lut3d_pipeline(const DcmIccContext *context,
+                                             const DcmIccPipelineKey *key,
+                                             DcmIccLut3d *lut3d) {
+    DcmIccPipeline *pipeline = dcm_icc_pipeline_create(context, key, NULL);
+    if (pipeline == NULL) {
+        dcm_icc_lut3d_destroy(lut3d);
+        return NULL;
+    }
+
+    pipeline->lut3d = lut3d;
+    pipeline->size += lut3d->size;
+
+    return pipeline;
+}
+
+/**
+ * Map the table of a pipeline built by this or another process
+ */
+static DcmIccPipeline *map_pipeline(const DcmIccContext *context,
+                                    const DcmIccPipelineKey *key,
+                                    const DcmIccLutFileKey *file_key,
+                                    const char *lut_path) {
+    if (key->engine == DCM_ICC_ENGINE_LUT24) {
+        DcmIccLut24 *lut24 = dcm_icc_lut24_map(context, lut_path, file_key);
+        if (lut24 != NULL) {
+            return create_lut24_pipeline(context, key, lut24);
+        }
+    } else if (key->engine == DCM_ICC_ENGINE_LUT3D) {
+        DcmIccLut3d *lut3d = dcm_icc_lut3d_map(context, lut_path, file_key,
+                                               key->lut_grid_points);
+        if (lut3d != NULL) {
+            return create_lut3d_pipeline(context, key, lut3d);
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Classify 8-bit transforms between matrix/TRC profiles and evaluate them
+ * with their own curves and matrix: identity transforms always, which is
+ * exact, the others only with fast paths. Returns NULL for all other
+ * transforms.
+ */
+static DcmIccPipeline *create_shaper_pipeline(const DcmIccContext *context,
+                                              const DcmIccPipelineKey *key,
+                                              cmsHPROFILE in_handle,
+                                              cmsHPROFILE out_handle,
+                                              DcmIccTransformClass *transform_class) {
+    *transform_class = DCM_ICC_CLASS_GENERAL;
+    if (T_BYTES(key->input_format) != 1 || T_BYTES(key->output_format) != 1) {
+        return NULL;
+    }
+
+    // Curves and matrix approximate lcms2, and the 24-bit table would no
+    // longer be bit-exact
+    const bool identity_only = !key->fast_paths || key->engine == DCM_ICC_ENGINE_LUT24;
+    DcmIccShaper *shaper = dcm_icc_shaper_create(context,
+                                                 in_handle,
+                                                 out_handle,
+                                                 key->intent,
+                                                 identity_only,
+                                                 transform_class);
+    if (shaper == NULL) {
+        return NULL;
+    }
+
+    DcmIccPipeline *pipeline = dcm_icc_pipeline_create(context, key, NULL);
+    if (pipeline == NULL) {
+        dcm_icc_shaper_destroy(shaper);
+        return NULL;
+    }
+
+    pipeline->shaper = shaper;
+    pipeline->size += sizeof(DcmIccShaper);
+
+    return pipeline;
+}
+
+/**
+ * Compile the transform from the ICC profile to the output profile. Tables
+ * are written to lut_path unless it is NULL.
+ */
+static DcmIccPipeline *build_pipeline(cmsHPROFILE in_handle,
+                                      cmsHPROFILE out_handle,
+                                      const DcmIccPipelineKey *key,
+                                      const DcmIccLutFileKey *file_key,
+                                      const DcmIccTransformOptions *options,
+                                      const char *lut_path) {
+    const cmsContext lcms_context = dcm_icc_context_get_lcms_context(options->context);
+    // Tables of YBR input are indexed by YCbCr
+    const bool ybr = T_COLORSPACE(key->input_format) == PT_YCbCr;
+    DcmIccLut24 *lut24 = NULL;
+    cmsHTRANSFORM transform_handle = NULL;
+    DcmIccLut3d *lut3d = NULL;
+
+    if (key->engine == DCM_ICC_ENGINE_LUT24) {
+        // Populate the table with the lcms2 transform itself, so that the
+        // table gives bit-exact results
+        const cmsHTRANSFORM populating_handle = cmsCreateTransformTHR(lcms_context,
+                                                                      in_handle,
+                                                                      TYPE_RGB_8,
+                                                                      out_handle,
+                                                                      TYPE_RGB_8,
+                                                                      key->intent,
+                                                                      0);
+        if (populating_handle == NULL) {
+            return NULL;
+        }
+
+        // A table that is written to a file is populated up front
+        const bool lazy = options->lut_lazy && lut_path == NULL;
+        lut24 = dcm_icc_lut24_create(options->context, populating_handle, ybr, lazy);
+        if (lut24 == NULL) {
             return NULL;
+        }
+        if (lut_path != NULL) {
+            dcm_icc_lut24_write(lut24, lut_path, file_key);
+        }
+
+        return create_lut24_pipeline(options->context, key, lut24);
+    } else if (key->engine == DCM_ICC_ENGINE_LUT3D) {
+        // Sample the unoptimised pipeline, the table replaces its optimisation
+        const cmsHTRANSFORM sampling_handle = cmsCreateTransformTHR(lcms_context,
+                                                                    in_handle,
+                                                                    TYPE_RGB_16,
+                                                                    out_handle,
+                                                                    TYPE_RGB_16,
+                                                                    key->intent,
+                                                                    cmsFLAGS_NOOPTIMIZE);
+        if (sampling_handle != NULL) {
+            lut3d = dcm_icc_lut3d_create(options->context, sampling_handle,
+                                         key->lut_grid_points, ybr);
+            cmsDeleteTransform(sampling_handle);
+        }
+        if (lut3d != NULL && lut_path != NULL) {
+            dcm_icc_lut3d_write(lut3d, lut_path, file_key);
+        }
+    } else {
+        transform_handle = cmsCreateTransformTHR(lcms_context,
+                                                 in_handle,
+                                                 key->input_format,
+                                                 out_handle,
+                                                 key->output_format,
+                                                 key->intent,
+                                                 key->flags);
+    }
+
+    if (transform_handle == NULL && lut3d == NULL) {
+        return NULL;
     }
 
+    DcmIccPipeline *pipeline = dcm_icc_pipeline_create(options->context, key,
+                                                       transform_handle);
+    if (pipeline == NULL) {
+        if (transform_handle) {
+            cmsDeleteTransform(transform_handle);
+        }
+        dcm_icc_lut3d_destroy(lut3d);
+        return NULL;
+    }
+
+    if (lut3d != NULL) {
+        pipeline->lut3d = lut3d;
+        pipeline->size += lut3d->size;
+    }
+
+    return pipeline;
+}
+
+/**
+ * Bypass the engine if the profiles allow it. Otherwise map the pipeline
+ * from its table file if another process has built it already, or build
+ * it.
+ */
+static DcmIccPipeline *create_pipeline(const char *icc_profile,
+                                       const DcmIccPipelineKey *key,
+                                       const DcmIccTransformOptions *options,
+                                       DcmIccCreationTimes *times) {
+    const cmsContext lcms_context = dcm_icc_context_get_lcms_context(options->context);
+    uint64_t start = dcm_icc_stats_now();
+
+    // Input ICC profile: obtained from DICOM data set
+    const cmsHPROFILE in_handle = cmsOpenProfileFromMemTHR(lcms_context,
+                                                           icc_profile,
+                                                           key->profile_size);
+    if (in_handle == NULL) {
+        return NULL;
+    }
+    uint64_t end = dcm_icc_stats_now();
+    times->profile_parse_ns = end - start;
+    start = end;
+
+    const cmsHPROFILE out_handle = dcm_icc_output_profile_open(lcms_context,
+                                                               key->output_type,
+                                                               key->output_profile_hash);
     if (out_handle == NULL) {
         cmsCloseProfile(in_handle);
         return NULL;
     }
+    end = dcm_icc_stats_now();
+    times->output_profile_ns = end - start;
+    start = end;
 
-    if (planar_configuration == 1) {
-        type = TYPE_RGB_8_PLANAR;
-    } else {
-        type = TYPE_RGB_8;
+    DcmIccTransformClass transform_class;
+    DcmIccPipeline *pipeline = create_shaper_pipeline(options->context, key,
+                                                      in_handle, out_handle,
+                                                      &transform_class);
+    if (pipeline == NULL) {
+        const DcmIccLutFileKey file_key = lut_file_key(key);
+        char *lut_path = lut_file_path(key, &file_key, options);
+
+        if (lut_path != NULL) {
+            pipeline = map_pipeline(options->context, key, &file_key, lut_path);
+        }
+        if (pipeline == NULL) {
+            pipeline = build_pipeline(in_handle, out_handle, key, &file_key,
+                                      options, lut_path);
+        }
+        free(lut_path);
     }
 
+    if (pipeline != NULL) {
+        pipeline->transform_class = transform_class;
+    }
 
-    const cmsHTRANSFORM transform_handle = cmsCreateTransform(in_handle,
-                                                              type,
-                                                              out_handle,
-                                                              type,
-                                                              INTENT_PERCEPTUAL,
-                                                              0);
+    // Only the curves are kept, the linearizer is built if it is ever used
+    if (pipeline != NULL &&
+        T_BYTES(key->input_format) == 1 && T_COLORSPACE(key->input_format) == PT_RGB) {
+        pipeline->linearizable = dcm_icc_linearizer_copy_curves(in_handle,
+                                                                pipeline->input_curves);
+    }
+    times->pipeline_build_ns = dcm_icc_stats_now() - start;
 
     cmsCloseProfile(in_handle);
     cmsCloseProfile(out_handle);
 
-    if (transform_handle == NULL) {
+    return pipeline;
+}
+
+void dcm_icc_transform_options_init(DcmIccTransformOptions *options) {
+    options->output_type = DCM_ICC_OUTPUT_SRGB;
+    options->planar_configuration = 0;
+    options->input_format = DCM_ICC_FORMAT_RGB_8;
+    options->output_format = DCM_ICC_FORMAT_RGB_8;
+    options->output_alpha = 1.0f;
+    options->engine = DCM_ICC_ENGINE_LCMS2;
+    options->lut_grid_points = DCM_ICC_LUT3D_DEFAULT_GRID_POINTS;
+    options->lut_lazy = false;
+    options->lut_path = NULL;
+    options->context = NULL;
+    options->fast_paths = false;
+    options->collect_stats = false;
+}
+
+DmcIccTransform *dcm_icc_transform_create_with_options(const char *icc_profile,
+                                                       uint32_t icc_profile_size,
+                                                       uint16_t columns,
+                                                       uint16_t rows,
+                                                       const DcmIccTransformOptions *options) {
+    DcmIccContext *context = options->context;
+    const DcmIccFormatInfo *input_format = get_format_info(options->input_format);
+    const DcmIccFormatInfo *output_format = get_format_info(options->output_format);
+    if (input_format == NULL || output_format == NULL) {
+        dcm_icc_error(context, "Invalid pixel format");
         return NULL;
     }
+    if (output_format->ybr) {
+        dcm_icc_error(context, "YBR formats are input formats only");
+        return NULL;
+    }
+    if (input_format->subsampled &&
+        (options->planar_configuration == 1 || columns % 2 != 0)) {
+        dcm_icc_error(context, "YBR_FULL_422 requires interleaved pixels and an even number of columns");
+        return NULL;
+    }
+
+    uint64_t output_profile_hash;
+    if (!dcm_icc_output_profile_get_hash(options->output_type, &output_profile_hash)) {
+        dcm_icc_error(context, "Unknown output type %u", (uint32_t)options->output_type);
+        return NULL;
+    }
+
+    const bool planar = options->planar_configuration == 1;
+    const bool alpha = input_format->alpha && output_format->alpha;
+
+    DcmIccPipelineKey key = {
+        .profile_hash = dcm_icc_hash(icc_profile, icc_profile_size),
+        .profile_size = icc_profile_size,
+        .output_type = options->output_type,
+        .output_profile_hash = output_profile_hash,
+        .intent = INTENT_PERCEPTUAL,
+        .input_format = input_format->type | PLANAR_SH(planar ? 1 : 0),
+        .output_format = output_format->type | PLANAR_SH(planar ? 1 : 0),
+        .flags = alpha ? cmsFLAGS_COPY_ALPHA : 0,
+        .engine = options->engine,
+        .lut_grid_points = 0,
+        .fast_paths = options->fast_paths,
+    };
+
+    switch (options->engine) {
+        case DCM_ICC_ENGINE_LCMS2:
+            break;
+        case DCM_ICC_ENGINE_LUT3D:
+        case DCM_ICC_ENGINE_LUT24:
+            if (input_format->bytes_per_sample != 1 ||
+                output_format->bytes_per_sample != 1) {
+                dcm_icc_error(context, "LUT engines require 8-bit pixel formats");
+                return NULL;
+            }
+            // The table is independent of the layout of the pixel data
+            key.input_format = input_format->ybr ? TYPE_YCbCr_8 : TYPE_RGB_8;
+            key.output_format = TYPE_RGB_8;
+            key.flags = 0;
+            break;
+        default:
+            dcm_icc_error(context, "Unknown transform engine %d", (int)options->engine);
+            return NULL;
+    }
+
+    if (options->engine == DCM_ICC_ENGINE_LCMS2 && input_format->ybr) {
+        // lcms2 receives the pixels converted to interleaved RGB
+        key.input_format = TYPE_RGB_8;
+    }
 
-    DmcIccTransform *icc_transform = calloc(1, sizeof(DmcIccTransform));
+    if (options->engine == DCM_ICC_ENGINE_LUT3D) {
+        if (options->lut_grid_points < 2 || options->lut_grid_points > 256) {
+            dcm_icc_error(context, "Invalid number of LUT grid points %u",
+                          options->lut_grid_points);
+            return NULL;
+        }
+        key.lut_grid_points = options->lut_grid_points;
+    }
+
+    DcmIccCreationTimes times = { 0, 0, 0 };
+    DcmIccCache *cache = dcm_icc_context_get_cache(context);
+    DcmIccPipeline *pipeline = dcm_icc_cache_lookup(cache, &key, icc_profile);
+    const bool cache_hit = pipeline != NULL;
+    if (pipeline == NULL) {
+        DcmIccPipeline *created = create_pipeline(icc_profile, &key, options, &times);
+        if (created == NULL) {
+            return NULL;
+        }
+
+        pipeline = dcm_icc_cache_insert(cache, created, icc_profile);
+        dcm_icc_pipeline_release(created);
+    }
+
+    DmcIccTransform *icc_transform = dcm_icc_calloc(context, 1, sizeof(DmcIccTransform));
     if (icc_transform == NULL) {
-        cmsDeleteTransform(transform_handle);
+        dcm_icc_pipeline_release(pipeline);
         return NULL;
     }
 
-    icc_transform->handle = transform_handle;
+    icc_transform->context = context;
+    icc_transform->pipeline = pipeline;
+    if (options->collect_stats) {
+        icc_transform->stats = dcm_icc_stats_create(context);
+        if (icc_transform->stats == NULL) {
+            dcm_icc_transform_destroy(icc_transform);
+            return NULL;
+        }
+        dcm_icc_stats_record_creation(icc_transform->stats, &times, cache_hit);
+    }
+    if (context != NULL && context->stats != NULL) {
+        icc_transform->context_stats = context->stats;
+        dcm_icc_stats_record_creation(context->stats, &times, cache_hit);
+    }
     icc_transform->number_of_pixels = (uint32_t)rows * (uint32_t)columns;
+    icc_transform->columns = columns;
+    icc_transform->rows = rows;
+    icc_transform->planar = planar;
+    icc_transform->input_format = input_format;
+    icc_transform->output_format = output_format;
+    icc_transform->input_layout = dcm_icc_frame_layout(input_format, columns,
+                                                       icc_transform->number_of_pixels,
+                                                       planar);
+    icc_transform->output_layout = dcm_icc_frame_layout(output_format, columns,
+                                                        icc_transform->number_of_pixels,
+                                                        planar);
+    icc_transform->copy_alpha = alpha &&
+                                (pipeline->lut3d || pipeline->lut24 || pipeline->shaper);
+    // Padding is left untouched, so only formats without it are copied whole
+    icc_transform->copy = pipeline->shaper != NULL &&
+                          pipeline->shaper->transform_class == DCM_ICC_CLASS_IDENTITY &&
+                          input_format == output_format &&
+                          (input_format->alpha || input_format->samples_per_pixel == 3);
+    icc_transform->fill_alpha = output_format->alpha && !input_format->alpha;
+    icc_transform->ybr_to_rgb = input_format->ybr && !(pipeline->lut3d || pipeline->lut24);
+    icc_transform->unpack = input_format->subsampled || icc_transform->ybr_to_rgb;
+    encode_sample(output_format, options->output_alpha, icc_transform->alpha_sample);
 
     return icc_transform;
 }
 
+DmcIccTransform *dcm_icc_transform_create_for_output(const char *icc_profile,
+                                                     uint32_t icc_profile_size,
+                                                     uint8_t planar_configuration,
+                                                     uint16_t columns,
+                                                     uint16_t rows,
+                                                     DcmIccOutputType output_type) {
+    DcmIccTransformOptions options;
+
+    dcm_icc_transform_options_init(&options);
+    options.output_type = output_type;
+    options.planar_configuration = planar_configuration;
+
+    return dcm_icc_transform_create_with_options(icc_profile,
+                                                 icc_profile_size,
+                                                 columns,
+                                                 rows,
+                                                 &options);
+}
+
 // Backward-compatible wrapper function
 DmcIccTransform *dcm_icc_transform_create(const char *icc_profile,
                                           uint32_t icc_profile_size,
@@ -320,23 +883,792 @@ DmcIccTransform *dcm_icc_transform_create(const char *icc_profile,
                                                DCM_ICC_OUTPUT_SRGB);
 }
 
+const char *dcm_icc_transform_get_kernel_name(const DmcIccTransform *icc_transform) {
+    if (icc_transform->copy) {
+        return "copy";
+    }
+    if (icc_transform->pipeline->shaper) {
+        return icc_transform->pipeline->shaper->kernel_name;
+    }
+    if (icc_transform->pipeline->lut24) {
+        return "lut24";
+    }
+    if (icc_transform->pipeline->lut3d) {
+        return icc_transform->pipeline->lut3d->kernel_name;
+    }
+    return "lcms2";
+}
+
+bool dcm_icc_transform_get_stats(const DmcIccTransform *icc_transform,
+                                 DcmIccStats *stats) {
+    if (icc_transform->stats == NULL) {
+        return false;
+    }
+    dcm_icc_stats_snapshot(icc_transform->stats, stats);
+    stats->kernel_name = dcm_icc_transform_get_kernel_name(icc_transform);
+    return true;
+}
+
+void dcm_icc_transform_reset_stats(const DmcIccTransform *icc_transform) {
+    if (icc_transform->stats != NULL) {
+        dcm_icc_stats_reset(icc_transform->stats);
+    }
+}
+
+DcmIccTransformClass dcm_icc_transform_get_class(const DmcIccTransform *icc_transform) {
+    return icc_transform->pipeline->transform_class;
+}
+
+bool dcm_icc_transform_write_lut(const DmcIccTransform *icc_transform,
+                                 const char *path) {
+    DcmIccPipeline *pipeline = icc_transform->pipeline;
+
+    if (pipeline->lut24 == NULL) {
+        dcm_icc_error(icc_transform->context, "Transform has no 24-bit lookup table");
+        return false;
+    }
+
+    const DcmIccLutFileKey file_key = lut_file_key(&pipeline->key);
+    return dcm_icc_lut24_write(pipeline->lut24, path, &file_key);
+}
+
+bool dcm_icc_transform_measure_accuracy(const char *icc_profile,
+                                        uint32_t icc_profile_size,
+                                        const DcmIccTransformOptions *options,
+                                        double *max_delta_e,
+                                        double *mean_delta_e) {
+    const uint32_t n = DCM_ICC_ACCURACY_LATTICE_POINTS;
+    const uint32_t number_of_pixels = n * n * n;
+    bool success = false;
+
+    DcmIccTransformOptions exact_options = *options;
+    exact_options.engine = DCM_ICC_ENGINE_LCMS2;
+    exact_options.fast_paths = false;
+    exact_options.planar_configuration = 0;
+    exact_options.input_format = DCM_ICC_FORMAT_RGB_8;
+    exact_options.output_format = DCM_ICC_FORMAT_RGB_8;
+    DcmIccTransformOptions test_options = exact_options;
+    test_options.engine = options->engine;
+    test_options.fast_paths = options->fast_paths;
+
+    DmcIccTransform *exact = dcm_icc_transform_create_with_options(icc_profile,
+                                                                   icc_profile_size,
+                                                                   n * n,
+                                                                   n,
+                                                                   &exact_options);
+    DmcIccTransform *test = dcm_icc_transform_create_with_options(icc_profile,
+                                                                  icc_profile_size,
+                                                                  n * n,
+                                                                  n,
+                                                                  &test_options);
+
+    // Compare colours in CIELAB, as seen through the output profile
+    cmsHTRANSFORM lab_transform = NULL;
+    const cmsContext lcms_context = dcm_icc_context_get_lcms_context(options->context);
+    uint64_t output_profile_hash = 0;
+    cmsHPROFILE out_handle = NULL;
+    if (dcm_icc_output_profile_get_hash(options->output_type, &output_profile_hash)) {
+        out_handle = dcm_icc_output_profile_open(lcms_context,
+                                                 options->output_type,
+                                                 output_profile_hash);
+    }
+    const cmsHPROFILE lab_handle = cmsCreateLab4ProfileTHR(lcms_context, NULL);
+    if (out_handle != NULL && lab_handle != NULL) {
+        lab_transform = cmsCreateTransformTHR(lcms_context,
+                                              out_handle,
+                                              TYPE_RGB_8,
+                                              lab_handle,
+                                              TYPE_Lab_DBL,
+                                              INTENT_RELATIVE_COLORIMETRIC,
+                                              0);
+    }
+    if (out_handle != NULL) {
+        cmsCloseProfile(out_handle);
+    }
+    if (lab_handle != NULL) {
+        cmsCloseProfile(lab_handle);
+    }
+
+    const DcmIccContext *context = options->context;
+    uint8_t *input = dcm_icc_malloc(context, (size_t)number_of_pixels * 3);
+    uint8_t *exact_output = dcm_icc_malloc(context, (size_t)number_of_pixels * 3);
+    uint8_t *test_output = dcm_icc_malloc(context, (size_t)number_of_pixels * 3);
+    cmsCIELab *exact_lab = dcm_icc_malloc(context, (size_t)number_of_pixels * sizeof(cmsCIELab));
+    cmsCIELab *test_lab = dcm_icc_malloc(context, (size_t)number_of_pixels * sizeof(cmsCIELab));
+
+    if (exact != NULL && test != NULL && lab_transform != NULL &&
+        input != NULL && exact_output != NULL && test_output != NULL &&
+        exact_lab != NULL && test_lab != NULL) {
+        size_t i = 0;
+        for (uint32_t r = 0; r < n; r++) {
+            for (uint32_t g = 0; g < n; g++) {
+                for (uint32_t b = 0; b < n; b++) {
+                    input[i++] = (uint8_t)((r * 255 + (n - 1) / 2) / (n - 1));
+                    input[i++] = (uint8_t)((g * 255 + (n - 1) / 2) / (n - 1));
+                    input[i++] = (uint8_t)((b * 255 + (n - 1) / 2) / (n - 1));
+                }
+            }
+        }
+
+        dcm_icc_transform_apply(exact, (const char *)input,
+                                number_of_pixels * 3, (char *)exact_output);
+        dcm_icc_transform_apply(test, (const char *)input,
+                                number_of_pixels * 3, (char *)test_output);
+        cmsDoTransform(lab_transform, exact_output, exact_lab, number_of_pixels);
+        cmsDoTransform(lab_transform, test_output, test_lab, number_of_pixels);
+
+        double max = 0.0;
+        double sum = 0.0;
+        for (i = 0; i < number_of_pixels; i++) {
+            const double delta_e = cmsCIE2000DeltaE(&exact_lab[i], &test_lab[i],
+                                                    1.0, 1.0, 1.0);
+            if (delta_e > max) {
+                max = delta_e;
+            }
+            sum += delta_e;
+        }
+
+        *max_delta_e = max;
+        *mean_delta_e = sum / number_of_pixels;
+        success = true;
+    }
+
+    dcm_icc_free(context, input);
+    dcm_icc_free(context, exact_output);
+    dcm_icc_free(context, test_output);
+    dcm_icc_free(context, exact_lab);
+    dcm_icc_free(context, test_lab);
+    if (lab_transform != NULL) {
+        cmsDeleteTransform(lab_transform);
+    }
+    dcm_icc_transform_destroy(exact);
+    dcm_icc_transform_destroy(test);
+
+    return success;
+}
+
+/**
+ * Transform pixels with the lookup tables of a pipeline
+ */
+static void apply_lut(const DcmIccPipeline *pipeline,
+                      const uint8_t *const src[3],
+                      size_t src_step,
+                      uint8_t *const dst[3],
+                      size_t dst_step,
+                      uint32_t count) {
+    if (pipeline->shaper) {
+        pipeline->shaper->kernel(pipeline->shaper, src, src_step, dst, dst_step, count);
+    } else if (pipeline->lut24) {
+        dcm_icc_lut24_apply(pipeline->lut24, src, src_step, dst, dst_step, count);
+    } else {
+        pipeline->lut3d->kernel(pipeline->lut3d, src, src_step, dst, dst_step, count);
+    }
+}
+
+/**
+ * Set the alpha samples of a row of pixels to the constant alpha of the
+ * transform
+ */
+static void fill_alpha(const DmcIccTransform *icc_transform,
+                       char *alpha,
+                       size_t step,
+                       uint32_t count) {
+    const uint8_t *sample = icc_transform->alpha_sample;
+    const size_t size = icc_transform->output_format->bytes_per_sample;
+
+    if (size == 1) {
+        for (uint32_t i = 0; i < count; i++) {
+            alpha[i * step] = (char)sample[0];
+        }
+    } else {
+        for (uint32_t i = 0; i < count; i++) {
+            memcpy(alpha + i * step, sample, size);
+        }
+    }
+}
+
+/**
+ * Transform a row of YBR pixels in chunks, which are upsampled and, unless
+ * the tables of the pipeline are indexed by YCbCr, converted to RGB on the
+ * stack. Subsampled rows are read from src[0].
+ */
+static void transform_ybr_row(const DmcIccTransform *icc_transform,
+                              const uint8_t *const src[3],
+                              size_t src_step,
+                              uint8_t *const dst[3],
+                              size_t dst_step,
+                              char *out_row,
+                              const DcmIccBufferLayout *out_layout,
+                              uint32_t width) {
+    const DcmIccPipeline *pipeline = icc_transform->pipeline;
+    uint8_t samples[DCM_ICC_YBR_CHUNK_PIXELS * 3];
+    uint32_t count;
+
+    for (uint32_t x = 0; x < width; x += count) {
+        count = width - x < DCM_ICC_YBR_CHUNK_PIXELS
+            ? width - x
+            : DCM_ICC_YBR_CHUNK_PIXELS;
+
+        const uint8_t *chunk[3] = {
+            src[0] + x * src_step,
+            src[1] + x * src_step,
+            src[2] + x * src_step
+        };
+        size_t chunk_step = src_step;
+        if (icc_transform->input_format->subsampled) {
+            dcm_icc_ybr_upsample_422(src[0] + x * 2, samples, count);
+            chunk[0] = samples;
+            chunk[1] = samples + 1;
+            chunk[2] = samples + 2;
+            chunk_step = 3;
+        }
+        if (icc_transform->ybr_to_rgb) {
+            dcm_icc_ybr_to_rgb(chunk, chunk_step, samples, count);
+            chunk[0] = samples;
+            chunk[1] = samples + 1;
+            chunk[2] = samples + 2;
+            chunk_step = 3;
+        }
+
+        if (pipeline->handle != NULL) {
+            cmsDoTransformLineStride(pipeline->handle,
+                                     samples,
+                                     out_row + x * dst_step,
+                                     count,
+                                     1,
+                                     count * 3,
+                                     (cmsUInt32Number)out_layout->row_stride,
+                                     0,
+                                     (cmsUInt32Number)out_layout->plane_stride);
+        } else {
+            uint8_t *const chunk_dst[3] = {
+                dst[0] + x * dst_step,
+                dst[1] + x * dst_step,
+                dst[2] + x * dst_step
+            };
+            apply_lut(pipeline, chunk, chunk_step, chunk_dst, dst_step, count);
+        }
+    }
+}
+
+/**
+ * Copy the rows of a block of an identity transform, or of each of its
+ * planes
+ */
+static void copy_block(const DmcIccTransform *icc_transform,
+                       const char *in,
+                       const DcmIccBufferLayout *in_layout,
+                       char *out,
+                       const DcmIccBufferLayout *out_layout,
+                       uint32_t width,
+                       uint32_t height) {
+    const DcmIccFormatInfo *format = icc_transform->input_format;
+    const uint32_t planes = icc_transform->planar ? format->samples_per_pixel : 1;
+    const size_t row_size = (size_t)width * format->bytes_per_sample *
+                            format->samples_per_pixel / planes;
+
+    if (in == out &&
+        in_layout->row_stride == out_layout->row_stride &&
+        in_layout->plane_stride == out_layout->plane_stride) {
+        return;
+    }
+
+    for (uint32_t plane = 0; plane < planes; plane++) {
+        for (uint32_t y = 0; y < height; y++) {
+            memmove(out + plane * out_layout->plane_stride + y * out_layout->row_stride,
+                    in + plane * in_layout->plane_stride + y * in_layout->row_stride,
+                    row_size);
+        }
+    }
+}
+
+void dcm_icc_transform_block(const DmcIccTransform *icc_transform,
+                             const char *in,
+                             const DcmIccBufferLayout *in_layout,
+                             char *out,
+                             const DcmIccBufferLayout *out_layout,
+                             uint32_t width,
+                             uint32_t height) {
+    const DcmIccPipeline *pipeline = icc_transform->pipeline;
+    const DcmIccFormatInfo *input = icc_transform->input_format;
+    const DcmIccFormatInfo *output = icc_transform->output_format;
+    const bool lut = pipeline->lut3d || pipeline->lut24 || pipeline->shaper;
+
+    if (icc_transform->copy) {
+        copy_block(icc_transform, in, in_layout, out, out_layout, width, height);
+        return;
+    }
+    if (!lut && !icc_transform->fill_alpha && !icc_transform->unpack) {
+        cmsDoTransformLineStride(pipeline->handle,
+                                 in,
+                                 out,
+                                 width,
+                                 height,
+                                 (cmsUInt32Number)in_layout->row_stride,
+                                 (cmsUInt32Number)out_layout->row_stride,
+                                 (cmsUInt32Number)in_layout->plane_stride,
+                                 (cmsUInt32Number)out_layout->plane_stride);
+        return;
+    }
+
+    // Distance between the samples of consecutive pixels and between the
+    // channels of a pixel
+    size_t in_step = input->bytes_per_sample;
+    size_t in_channel = in_layout->plane_stride;
+    size_t out_step = output->bytes_per_sample;
+    size_t out_channel = out_layout->plane_stride;
+    if (!icc_transform->planar) {
+        in_channel = in_step;
+        in_step *= input->samples_per_pixel;
+        out_channel = out_step;
+        out_step *= output->samples_per_pixel;
+    }
+
+    for (uint32_t y = 0; y < height; y++) {
+        const char *in_row = in + y * in_layout->row_stride;
+        char *out_row = out + y * out_layout->row_stride;
+
+        if (icc_transform->unpack) {
+            const uint8_t *src = (const uint8_t *)in_row;
+            uint8_t *dst = (uint8_t *)out_row;
+            const uint8_t *const src_channels[3] = {
+                src + input->positions[0] * in_channel,
+                src + input->positions[1] * in_channel,
+                src + input->positions[2] * in_channel
+            };
+            uint8_t *const dst_channels[3] = {
+                dst + output->positions[0] * out_channel,
+                dst + output->positions[1] * out_channel,
+                dst + output->positions[2] * out_channel
+            };
+            transform_ybr_row(icc_transform, src_channels, in_step,
+                              dst_channels, out_step, out_row, out_layout, width);
+        } else if (lut) {
+            const uint8_t *src = (const uint8_t *)in_row;
+            uint8_t *dst = (uint8_t *)out_row;
+            const uint8_t *const src_channels[3] = {
+                src + input->positions[0] * in_channel,
+                src + input->positions[1] * in_channel,
+                src + input->positions[2] * in_channel
+            };
+            uint8_t *const dst_channels[3] = {
+                dst + output->positions[0] * out_channel,
+                dst + output->positions[1] * out_channel,
+                dst + output->positions[2] * out_channel
+            };
+            apply_lut(pipeline, src_channels, in_step, dst_channels, out_step, width);
+
+            if (icc_transform->copy_alpha) {
+                const uint8_t *src_alpha = src + input->positions[3] * in_channel;
+                uint8_t *dst_alpha = dst + output->positions[3] * out_channel;
+                for (uint32_t i = 0; i < width; i++) {
+                    dst_alpha[i * out_step] = src_alpha[i * in_step];
+                }
+            }
+        } else {
+            cmsDoTransformLineStride(pipeline->handle,
+                                     in_row,
+                                     out_row,
+                                     width,
+                                     1,
+                                     (cmsUInt32Number)in_layout->row_stride,
+                                     (cmsUInt32Number)out_layout->row_stride,
+                                     (cmsUInt32Number)in_layout->plane_stride,
+                                     (cmsUInt32Number)out_layout->plane_stride);
+        }
+
+        if (icc_transform->fill_alpha) {
+            fill_alpha(icc_transform,
+                       out_row + output->positions[3] * out_channel,
+                       out_step,
+                       width);
+        }
+    }
+}
+
+/**
+ * Transform a contiguous range of rows of a frame
+ */
+uint64_t dcm_icc_transform_begin_call(const DmcIccTransform *icc_transform) {
+    if (icc_transform->stats == NULL && icc_transform->context_stats == NULL) {
+        return 0;
+    }
+    return dcm_icc_stats_now();
+}
+
+void dcm_icc_transform_end_call(const DmcIccTransform *icc_transform,
+                                uint64_t start,
+                                uint64_t number_of_pixels) {
+    if (start == 0) {
+        return;
+    }
+    const uint64_t elapsed_ns = dcm_icc_stats_now() - start;
+    if (icc_transform->stats != NULL) {
+        dcm_icc_stats_record_apply(icc_transform->stats, elapsed_ns, number_of_pixels);
+    }
+    if (icc_transform->context_stats != NULL) {
+        dcm_icc_stats_record_apply(icc_transform->context_stats, elapsed_ns,
+                                   number_of_pixels);
+    }
+}
+
+static void transform_rows(const DmcIccTransform *icc_transform,
+                           const char *frame,
+                           char *corrected_frame,
+                           uint32_t first_row,
+                           uint32_t number_of_rows) {
+    const DcmIccBufferLayout *in_layout = &icc_transform->input_layout;
+    const DcmIccBufferLayout *out_layout = &icc_transform->output_layout;
+
+    dcm_icc_transform_block(icc_transform,
+                            frame + (size_t)first_row * in_layout->row_stride,
+                            in_layout,
+                            corrected_frame + (size_t)first_row * out_layout->row_stride,
+                            out_layout,
+                            icc_transform->columns,
+                            number_of_rows);
+}
+
 void dcm_icc_transform_apply(const DmcIccTransform *icc_transform,
                              const char *frame,
                              uint32_t frame_size,
                              char *corrected_frame) {
-    cmsDoTransform(icc_transform->handle,
-                   frame,
-                   corrected_frame,
-                   icc_transform->number_of_pixels);
+    const uint64_t start = dcm_icc_transform_begin_call(icc_transform);
+
+    transform_rows(icc_transform, frame, corrected_frame, 0, icc_transform->rows);
+
+    dcm_icc_transform_end_call(icc_transform, start, icc_transform->number_of_pixels);
+}
+
+void dcm_icc_transform_apply_with_stride(const DmcIccTransform *icc_transform,
+                                         const char *frame,
+                                         uint32_t frame_size,
+                                         char *corrected_frame,
+                                         uint32_t corrected_row_stride) {
+    const uint64_t start = dcm_icc_transform_begin_call(icc_transform);
+    DcmIccBufferLayout out_layout = icc_transform->output_layout;
+
+    if (corrected_row_stride != 0) {
+        out_layout.row_stride = corrected_row_stride;
+        if (icc_transform->planar) {
+            out_layout.plane_stride = (size_t)corrected_row_stride * icc_transform->rows;
+        }
+    }
+
+    dcm_icc_transform_block(icc_transform,
+                            frame,
+                            &icc_transform->input_layout,
+                            corrected_frame,
+                            &out_layout,
+                            icc_transform->columns,
+                            icc_transform->rows);
+
+    dcm_icc_transform_end_call(icc_transform, start, icc_transform->number_of_pixels);
+}
+
+bool dcm_icc_transform_apply_region(const DmcIccTransform *icc_transform,
+                                    const char *frame,
+                                    uint32_t frame_row_stride,
+                                    uint32_t frame_plane_stride,
+                                    const DcmIccRegion *region,
+                                    char *corrected_frame,
+                                    uint32_t corrected_row_stride,
+                                    uint32_t corrected_plane_stride) {
+    const DcmIccFormatInfo *input = icc_transform->input_format;
+    const DcmIccFormatInfo *output = icc_transform->output_format;
+    DcmIccBufferLayout in_layout = icc_transform->input_layout;
+    DcmIccBufferLayout out_layout;
+
+    if (frame_row_stride == 0 &&
+        ((uint64_t)region->x + region->width > icc_transform->columns ||
+         (uint64_t)region->y + region->height > icc_transform->rows)) {
+        dcm_icc_error(icc_transform->context, "Region exceeds the frame");
+        return false;
+    }
+    if (input->subsampled && (region->x % 2 != 0 || region->width % 2 != 0)) {
+        dcm_icc_error(icc_transform->context, "Region splits YBR_FULL_422 pixel pairs");
+        return false;
+    }
+    if (region->width == 0 || region->height == 0) {
+        return true;
+    }
+
+    const uint64_t start = dcm_icc_transform_begin_call(icc_transform);
+
+    if (frame_row_stride != 0) {
+        in_layout.row_stride = frame_row_stride;
+        in_layout.plane_stride = frame_plane_stride;
+    }
+
+    // Samples of a pixel are adjacent unless the pixels are planar
+    size_t in_pixel_size = input->bytes_per_sample;
+    size_t out_pixel_size = output->bytes_per_sample;
+    if (!icc_transform->planar) {
+        in_pixel_size *= input->samples_per_pixel;
+        out_pixel_size *= output->samples_per_pixel;
+    }
+
+    if (corrected_row_stride != 0) {
+        out_layout.row_stride = corrected_row_stride;
+        out_layout.plane_stride = corrected_plane_stride;
+    } else {
+        // Packed output block
+        out_layout.row_stride = region->width * out_pixel_size;
+        out_layout.plane_stride = icc_transform->planar
+            ? out_layout.row_stride * region->height
+            : 0;
+    }
+
+    dcm_icc_transform_block(icc_transform,
+                            frame + region->y * in_layout.row_stride + region->x * in_pixel_size,
+                            &in_layout,
+                            corrected_frame,
+                            &out_layout,
+                            region->width,
+                            region->height);
+
+    dcm_icc_transform_end_call(icc_transform, start,
+                               (uint64_t)region->width * region->height);
+
+    return true;
+}
+
+static void transform_stripe(void *arg, uint32_t index) {
+    const DcmIccStripeJob *job = arg;
+    const uint32_t rows = job->icc_transform->rows;
+    const uint32_t first_row = index * job->rows_per_stripe;
+    uint32_t number_of_rows = job->rows_per_stripe;
+
+    if (first_row + number_of_rows > rows) {
+        number_of_rows = rows - first_row;
+    }
+
+    transform_rows(job->icc_transform,
+                   job->frame,
+                   job->corrected_frame,
+                   first_row,
+                   number_of_rows);
+}
+
+void dcm_icc_transform_apply_parallel(const DmcIccTransform *icc_transform,
+                                      DcmIccThreadPool *pool,
+                                      const char *frame,
+                                      uint32_t frame_size,
+                                      char *corrected_frame) {
+    const uint32_t rows = icc_transform->rows;
+    const uint32_t columns = icc_transform->columns;
+
+    if (rows == 0 || columns == 0) {
+        return;
+    }
+
+    uint32_t number_of_stripes =
+        dcm_icc_thread_pool_get_number_of_threads(pool) * DCM_ICC_STRIPES_PER_THREAD;
+    uint32_t min_rows_per_stripe =
+        (DCM_ICC_MIN_PIXELS_PER_STRIPE + columns - 1) / columns;
+    uint32_t rows_per_stripe = number_of_stripes > 0
+        ? (rows + number_of_stripes - 1) / number_of_stripes
+        : rows;
+    if (rows_per_stripe < min_rows_per_stripe) {
+        rows_per_stripe = min_rows_per_stripe;
+    }
+    if (rows_per_stripe > rows) {
+        rows_per_stripe = rows;
+    }
+    number_of_stripes = (rows + rows_per_stripe - 1) / rows_per_stripe;
+
+    const uint64_t start = dcm_icc_transform_begin_call(icc_transform);
+    DcmIccStripeJob job = {
+        .icc_transform = icc_transform,
+        .frame = frame,
+        .corrected_frame = corrected_frame,
+        .rows_per_stripe = rows_per_stripe,
+    };
+    dcm_icc_thread_pool_run(pool, transform_stripe, &job, number_of_stripes);
+
+    dcm_icc_transform_end_call(icc_transform, start, icc_transform->number_of_pixels);
+}
+
+bool dcm_icc_transform_apply_in_place(const DmcIccTransform *icc_transform,
+                                      DcmIccThreadPool *pool,
+                                      char *frame,
+                                      uint32_t frame_size) {
+    // lcms2 and the LUT kernels read all samples of a pixel before writing
+    // them, so pixels may be overwritten as long as their layout does not
+    // change. Stripes never share rows.
+    if (icc_transform->input_format != icc_transform->output_format) {
+        dcm_icc_error(icc_transform->context,
+                      "In-place transforms require the same input and output pixel format");
+        return false;
+    }
+
+    dcm_icc_transform_apply_parallel(icc_transform, pool, frame, frame_size, frame);
+
+    return true;
+}
+
+static void transform_batch_unit(void *arg, uint32_t index) {
+    const DcmIccBatchJob *job = arg;
+    const DmcIccTransform *icc_transform = job->icc_transform;
+    const DcmIccBatchUnit *unit = &job->units[index];
+    const DcmIccBatchItem *item = &job->items[unit->item];
+    const size_t number_of_pixels = (size_t)item->columns * item->rows;
+
+    const DcmIccBufferLayout in_layout = dcm_icc_frame_layout(icc_transform->input_format,
+                                                              item->columns,
+                                                              number_of_pixels,
+                                                              icc_transform->planar);
+    const DcmIccBufferLayout out_layout = dcm_icc_frame_layout(icc_transform->output_format,
+                                                               item->columns,
+                                                               number_of_pixels,
+                                                               icc_transform->planar);
+
+    dcm_icc_transform_block(icc_transform,
+                            item->frame + (size_t)unit->first_row * in_layout.row_stride,
+                            &in_layout,
+                            item->corrected_frame + (size_t)unit->first_row * out_layout.row_stride,
+                            &out_layout,
+                            item->columns,
+                            unit->number_of_rows);
+}
+
+/**
+ * Resolve the dimensions of a batch item and check its buffers
+ */
+static DcmIccBatchStatus check_batch_item(const DmcIccTransform *icc_transform,
+                                          DcmIccBatchItem *item) {
+    if (item->columns == 0) {
+        item->columns = icc_transform->columns;
+    }
+    if (item->rows == 0) {
+        item->rows = icc_transform->rows;
+    }
+    if (item->frame == NULL || item->corrected_frame == NULL ||
+        item->columns == 0 || item->rows == 0 ||
+        (icc_transform->input_format->subsampled && item->columns % 2 != 0)) {
+        return DCM_ICC_BATCH_INVALID_ARGUMENT;
+    }
+
+    const uint64_t number_of_pixels = (uint64_t)item->columns * item->rows;
+    const uint64_t frame_size = number_of_pixels *
+        icc_transform->input_format->bytes_per_sample *
+        icc_transform->input_format->samples_per_pixel;
+    const uint64_t corrected_frame_size = number_of_pixels *
+        icc_transform->output_format->bytes_per_sample *
+        icc_transform->output_format->samples_per_pixel;
+    if (item->frame_size < frame_size ||
+        item->corrected_frame_size < corrected_frame_size) {
+        return DCM_ICC_BATCH_BUFFER_TOO_SMALL;
+    }
+
+    return DCM_ICC_BATCH_SUCCESS;
+}
+
+static uint32_t batch_rows_per_unit(const DcmIccBatchItem *item,
+                                    uint64_t pixels_per_unit) {
+    uint64_t rows = pixels_per_unit / item->columns;
+    if (pixels_per_unit % item->columns != 0) {
+        rows++;
+    }
+    return rows < item->rows ? (uint32_t)rows : item->rows;
+}
+
+uint32_t dcm_icc_transform_apply_batch(const DmcIccTransform *icc_transform,
+                                       DcmIccThreadPool *pool,
+                                       DcmIccBatchItem *items,
+                                       uint32_t number_of_items) {
+    const uint64_t start = dcm_icc_transform_begin_call(icc_transform);
+    uint32_t number_of_failures = 0;
+    uint64_t total_pixels = 0;
+
+    for (uint32_t i = 0; i < number_of_items; i++) {
+        items[i].status = check_batch_item(icc_transform, &items[i]);
+        if (items[i].status == DCM_ICC_BATCH_SUCCESS) {
+            total_pixels += (uint64_t)items[i].columns * items[i].rows;
+        } else {
+            number_of_failures++;
+        }
+    }
+    if (total_pixels == 0) {
+        return number_of_failures;
+    }
+
+    // Small items are units of work on their own, large ones are split into
+    // stripes so that a batch of few frames still keeps all workers busy
+    const uint32_t number_of_threads = dcm_icc_thread_pool_get_number_of_threads(pool);
+    uint64_t pixels_per_unit = DCM_ICC_MIN_PIXELS_PER_STRIPE;
+    if (number_of_threads > 0) {
+        const uint64_t share = total_pixels /
+            ((uint64_t)number_of_threads * DCM_ICC_STRIPES_PER_THREAD);
+        if (share > pixels_per_unit) {
+            pixels_per_unit = share;
+        }
+    } else {
+        pixels_per_unit = UINT64_MAX;
+    }
+
+    uint64_t number_of_units = 0;
+    for (uint32_t i = 0; i < number_of_items; i++) {
+        if (items[i].status == DCM_ICC_BATCH_SUCCESS) {
+            const uint32_t rows_per_unit = batch_rows_per_unit(&items[i], pixels_per_unit);
+            number_of_units += (items[i].rows + (uint64_t)rows_per_unit - 1) / rows_per_unit;
+        }
+    }
+
+    DcmIccBatchUnit *units = NULL;
+    if (number_of_units <= UINT32_MAX) {
+        units = dcm_icc_malloc(icc_transform->context,
+                               (size_t)number_of_units * sizeof(DcmIccBatchUnit));
+    }
+    if (units == NULL) {
+        // Fall back to transforming items one after the other
+        for (uint32_t i = 0; i < number_of_items; i++) {
+            if (items[i].status == DCM_ICC_BATCH_SUCCESS) {
+                const DcmIccBatchUnit unit = { i, 0, items[i].rows };
+                const DcmIccBatchJob job = { icc_transform, items, &unit };
+                transform_batch_unit((void *)&job, 0);
+            }
+        }
+        dcm_icc_transform_end_call(icc_transform, start, total_pixels);
+        return number_of_failures;
+    }
+
+    uint32_t unit_index = 0;
+    for (uint32_t i = 0; i < number_of_items; i++) {
+        if (items[i].status != DCM_ICC_BATCH_SUCCESS) {
+            continue;
+        }
+        const uint32_t rows_per_unit = batch_rows_per_unit(&items[i], pixels_per_unit);
+        for (uint64_t row = 0; row < items[i].rows; row += rows_per_unit) {
+            const uint32_t remaining = items[i].rows - (uint32_t)row;
+            units[unit_index].item = i;
+            units[unit_index].first_row = (uint32_t)row;
+            units[unit_index].number_of_rows = remaining < rows_per_unit
+                ? remaining
+                : rows_per_unit;
+            unit_index++;
+        }
+    }
+
+    DcmIccBatchJob job = {
+        .icc_transform = icc_transform,
+        .items = items,
+        .units = units,
+    };
+    dcm_icc_thread_pool_run(pool, transform_batch_unit, &job, unit_index);
+    dcm_icc_free(icc_transform->context, units);
+
+    dcm_icc_transform_end_call(icc_transform, start, total_pixels);
+
+    return number_of_failures;
 }
 
 void dcm_icc_transform_destroy(DmcIccTransform *icc_transform) {
     if (icc_transform) {
-        if (icc_transform->handle) {
-            cmsDeleteTransform(icc_transform->handle);
-            icc_transform->handle = NULL;
-        }
-        free(icc_transform);
+        dcm_icc_pipeline_release(icc_transform->pipeline);
+        icc_transform->pipeline = NULL;
+        dcm_icc_stats_destroy(icc_transform->context, icc_transform->stats);
+        dcm_icc_free(icc_transform->context, icc_transform);
         icc_transform = NULL;
     }
 }
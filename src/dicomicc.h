@@ -1,18 +1,160 @@
 #include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
 
 #ifndef DCM_ICC_INCLUDED
 #define DCM_ICC_INCLUDED
 
 typedef struct _DmcIccTransform DmcIccTransform;
 
+typedef struct _DcmIccThreadPool DcmIccThreadPool;
+
+typedef struct _DcmIccStream DcmIccStream;
+
+typedef struct _DcmIccSink DcmIccSink;
+
+typedef struct _DcmIccContext DcmIccContext;
+
+typedef struct _DcmIccTransformSet DcmIccTransformSet;
+
+typedef struct _DcmIccScheduler DcmIccScheduler;
+
+typedef struct _DcmIccJob DcmIccJob;
+
+// Default capacity of the transform cache in bytes
+#define DCM_ICC_CACHE_DEFAULT_CAPACITY (64 * 1024 * 1024)
+
 // Enum to specify the desired output ICC profile type
 typedef enum {
     DCM_ICC_OUTPUT_SRGB = 0,        // Standard sRGB    profile
     DCM_ICC_OUTPUT_DISPLAY_P3 = 1,  // Display-P3       profile
     DCM_ICC_OUTPUT_ADOBE_RGB = 2,   // Adobe RGB (1998) profile
-    DCM_ICC_OUTPUT_ROMM_RGB = 3     // ROMM RGB         profile
+    DCM_ICC_OUTPUT_ROMM_RGB = 3,    // ROMM RGB         profile
+    DCM_ICC_OUTPUT_CUSTOM = 256     // First id of registered profiles
 } DcmIccOutputType;
 
+// Enum to specify how pixels are mapped from input to output colours
+typedef enum {
+    DCM_ICC_ENGINE_LCMS2 = 0,  // Evaluate the optimised lcms2 pipeline
+    DCM_ICC_ENGINE_LUT3D = 1,  // Interpolate in a 3D LUT baked at creation
+    DCM_ICC_ENGINE_LUT24 = 2   // Look up every 8-bit colour in a 48 MB table
+} DcmIccEngine;
+
+// Enum to specify how a transform maps colours, found by analysing the
+// profiles of 8-bit transforms between RGB matrix/TRC profiles
+typedef enum {
+    DCM_ICC_CLASS_GENERAL = 0,   // Evaluated by the engine of the transform
+    DCM_ICC_CLASS_IDENTITY = 1,  // Colours are unchanged
+    DCM_ICC_CLASS_CURVES = 2,    // Each channel passes through its own curve
+    DCM_ICC_CLASS_MATRIX = 3     // Curves, a 3x3 matrix and curves
+} DcmIccTransformClass;
+
+// Enum to specify the layout of the samples of a pixel. Formats with alpha
+// carry it through the transform (alpha is set to output_alpha if the input
+// has none), padding samples are left untouched on output. YBR formats are
+// input formats and also cover YBR_ICT, which shares the YBR_FULL equations;
+// YBR_RCT needs more than 8 bits for chroma and is not supported (JPEG 2000
+// decoders return RGB for both). YBR_FULL_422 pixels are interleaved, and
+// frames, regions and tiles start and end at even columns.
+typedef enum {
+    DCM_ICC_FORMAT_RGB_8 = 0,       // 8-bit unsigned R, G, B
+    DCM_ICC_FORMAT_RGB_16 = 1,      // 16-bit unsigned R, G, B
+    DCM_ICC_FORMAT_RGB_HALF = 2,    // 16-bit float R, G, B in [0, 1]
+    DCM_ICC_FORMAT_RGB_FLOAT = 3,   // 32-bit float R, G, B in [0, 1]
+    DCM_ICC_FORMAT_RGBA_8 = 4,      // 8-bit unsigned R, G, B, alpha
+    DCM_ICC_FORMAT_RGBA_16 = 5,     // 16-bit unsigned R, G, B, alpha
+    DCM_ICC_FORMAT_RGBA_HALF = 6,   // 16-bit float R, G, B, alpha
+    DCM_ICC_FORMAT_RGBA_FLOAT = 7,  // 32-bit float R, G, B, alpha
+    DCM_ICC_FORMAT_RGBX_8 = 8,      // 8-bit unsigned R, G, B, padding
+    DCM_ICC_FORMAT_RGBX_16 = 9,     // 16-bit unsigned R, G, B, padding
+    DCM_ICC_FORMAT_BGRA_8 = 10,     // 8-bit unsigned B, G, R, alpha
+    DCM_ICC_FORMAT_ARGB_8 = 11,     // 8-bit unsigned alpha, R, G, B
+    DCM_ICC_FORMAT_YBR_FULL_8 = 12,     // 8-bit unsigned Y, Cb, Cr
+    DCM_ICC_FORMAT_YBR_FULL_422_8 = 13  // 8-bit unsigned Y1, Y2, Cb, Cr per
+                                        // pair of pixels
+} DcmIccPixelFormat;
+
+// Default number of 3D LUT grid points per axis
+#define DCM_ICC_LUT3D_DEFAULT_GRID_POINTS 33
+
+// Rectangle of pixels, in pixels from the top left corner of a frame
+typedef struct {
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+} DcmIccRegion;
+
+// Transform creation options, initialize with dcm_icc_transform_options_init()
+typedef struct {
+    DcmIccOutputType output_type;
+    uint8_t planar_configuration;   // Applies to input and output pixels
+    DcmIccPixelFormat input_format;
+    DcmIccPixelFormat output_format;
+    float output_alpha;             // Alpha written if the input has none, [0, 1]
+    DcmIccEngine engine;            // LUT engines require 8-bit formats
+    uint32_t lut_grid_points;       // 3D LUT grid points per axis, [2, 256]
+    bool lut_lazy;                  // Populate the 24-bit table on first use
+    const char *lut_path;           // 24-bit table file, mapped if it exists
+                                    // and written otherwise
+    DcmIccContext *context;         // Context to create the transform in,
+                                    // NULL = process-wide state
+    bool fast_paths;                // Bypass the engine for curves and matrix
+                                    // transforms (not LUT24), approximating
+                                    // lcms2; identity transforms always
+                                    // bypass it. False by default.
+    bool collect_stats;             // Count and time calls, see
+                                    // dcm_icc_transform_get_stats()
+} DcmIccTransformOptions;
+
+// Receives the error messages of a context
+typedef void (*DcmIccErrorCallback)(void *user_data, const char *message);
+
+// Memory allocation functions of a context, used for the transforms, caches
+// and lookup tables of the context and, through its memory plugin, by lcms2
+// (but for the small block of the lcms2 context, which comes from malloc()).
+// user_data may carry an arena: free may then do nothing if the arena is
+// released once the context is destroyed.
+typedef struct {
+    void *(*malloc)(void *user_data, size_t size);
+    void *(*realloc)(void *user_data, void *pointer, size_t size);
+    void (*free)(void *user_data, void *pointer);
+    void *user_data;
+} DcmIccAllocator;
+
+// Context creation options, initialize with dcm_icc_context_options_init()
+typedef struct {
+    DcmIccErrorCallback error_callback;  // NULL = print to stderr
+    void *user_data;                     // Passed to the error callback
+    size_t cache_capacity;               // Capacity of the transform cache
+    const DcmIccAllocator *allocator;    // NULL = malloc(), realloc(), free()
+    bool collect_stats;                  // Count and time the calls of all
+                                         // transforms of the context
+} DcmIccContextOptions;
+
+// Buckets of the histogram of apply calls by microseconds per megapixel
+#define DCM_ICC_STATS_HISTOGRAM_BUCKETS 24
+
+// Statistics of a transform or of all transforms of a context. Bucket i of
+// the histogram counts calls that took [2^i, 2^(i+1)) microseconds per
+// megapixel; the first and last buckets also count faster and slower calls.
+typedef struct {
+    uint64_t transforms_created;
+    uint64_t cache_hits;            // Pipelines found in the cache
+    uint64_t cache_misses;          // Pipelines created
+    uint64_t profile_parse_ns;      // Time spent parsing input profiles
+    uint64_t output_profile_ns;     // Time spent creating output profiles
+    uint64_t pipeline_build_ns;     // Time spent building pipelines and tables
+    uint64_t apply_calls;           // Frames, regions, batches, stream strips
+                                    // and sink commits transformed
+    uint64_t pixels;
+    uint64_t apply_ns;              // Wall-clock time of apply calls
+    double ns_per_megapixel;        // apply_ns per million pixels
+    uint64_t histogram[DCM_ICC_STATS_HISTOGRAM_BUCKETS];
+    uint64_t errors;                // Errors reported, contexts only
+    const char *kernel_name;        // Transforms only, NULL for contexts
+} DcmIccStats;
+
 extern const char *dcm_icc_get_version(void);
 
 extern DmcIccTransform *dcm_icc_transform_create_for_output(const char *icc_profile,
@@ -28,11 +170,377 @@ extern DmcIccTransform *dcm_icc_transform_create(const char *icc_profile,
                                                  uint16_t columns,
                                                  uint16_t rows);
 
+extern void dcm_icc_transform_options_init(DcmIccTransformOptions *options);
+
+extern DmcIccTransform *dcm_icc_transform_create_with_options(const char *icc_profile,
+                                                              uint32_t icc_profile_size,
+                                                              uint16_t columns,
+                                                              uint16_t rows,
+                                                              const DcmIccTransformOptions *options);
+
+// Register an RGB ICC profile, e.g. of a calibrated display, as destination
+// of transforms created with the given output type, which must be at least
+// DCM_ICC_OUTPUT_CUSTOM. Replaces the profile registered for the output
+// type before; transforms created with it remain valid.
+extern bool dcm_icc_output_profile_register(DcmIccOutputType output_type,
+                                            const char *icc_profile,
+                                            uint32_t icc_profile_size);
+
+extern bool dcm_icc_output_profile_unregister(DcmIccOutputType output_type);
+
+// Name of the code path used to apply the transform, e.g. "lut3d-avx2"
+extern const char *dcm_icc_transform_get_kernel_name(const DmcIccTransform *icc_transform);
+
+// Class of the colour mapping of a transform. Identity transforms between
+// equal pixel formats copy pixels; callers may skip them altogether.
+extern DcmIccTransformClass dcm_icc_transform_get_class(const DmcIccTransform *icc_transform);
+
+// Statistics of a transform created with collect_stats. Returns false if the
+// transform collects none. Safe to call while the transform is in use.
+extern bool dcm_icc_transform_get_stats(const DmcIccTransform *icc_transform,
+                                        DcmIccStats *stats);
+
+// Zero all statistics of a transform, e.g. between benchmark runs
+extern void dcm_icc_transform_reset_stats(const DmcIccTransform *icc_transform);
+
+// Compare transforms created with the given options against the exact lcms2
+// transform on a lattice of 8-bit RGB colours and report the CIEDE2000
+// colour difference in the output colour space.
+extern bool dcm_icc_transform_measure_accuracy(const char *icc_profile,
+                                               uint32_t icc_profile_size,
+                                               const DcmIccTransformOptions *options,
+                                               double *max_delta_e,
+                                               double *mean_delta_e);
+
+// Write the 24-bit table of a transform to a file that other processes can
+// map via DcmIccTransformOptions.lut_path. Identity transforms have none.
+extern bool dcm_icc_transform_write_lut(const DmcIccTransform *icc_transform,
+                                        const char *path);
+
+// Size in bytes of a pixel of a format, summed over all planes
+extern uint32_t dcm_icc_pixel_format_get_size(DcmIccPixelFormat format);
+
+// Transform a frame into corrected_frame, the buffers must not overlap
 extern void dcm_icc_transform_apply(const DmcIccTransform *icc_transform,
                                     const char *frame,
                                     uint32_t frame_size,
                                     char *corrected_frame);
 
+// Same as dcm_icc_transform_apply(), but rows of the corrected frame are
+// corrected_row_stride bytes apart (0 = packed rows), e.g. to write into a
+// framebuffer with padded rows.
+extern void dcm_icc_transform_apply_with_stride(const DmcIccTransform *icc_transform,
+                                                const char *frame,
+                                                uint32_t frame_size,
+                                                char *corrected_frame,
+                                                uint32_t corrected_row_stride);
+
+// Transform a region of a frame into a width x height block at the start of
+// corrected_frame. Strides are in bytes; plane strides only apply to planar
+// pixels. Zero strides describe the frame the transform was created for and
+// a packed output block respectively. With explicit strides frames of any
+// size can be transformed, the region is then not checked against the frame.
+extern bool dcm_icc_transform_apply_region(const DmcIccTransform *icc_transform,
+                                           const char *frame,
+                                           uint32_t frame_row_stride,
+                                           uint32_t frame_plane_stride,
+                                           const DcmIccRegion *region,
+                                           char *corrected_frame,
+                                           uint32_t corrected_row_stride,
+                                           uint32_t corrected_plane_stride);
+
+// Filter that averages blocks of pixels when downsampling
+typedef enum {
+    DCM_ICC_DOWNSAMPLE_BOX = 0,     // Average the encoded samples
+    DCM_ICC_DOWNSAMPLE_LINEAR = 1   // Average in linear light, using the tone
+                                    // curves of the input profile (or the
+                                    // sRGB curve if it has none); RGB only
+} DcmIccDownsampleFilter;
+
+// Same as dcm_icc_transform_apply_region(), but the region is downsampled
+// by factor (2 to 16, e.g. 2 or 4 per pyramid level) before it is
+// transformed, so only the output pixels are transformed. The output block
+// is ceil(width / factor) x ceil(height / factor) pixels; blocks at the
+// right and bottom edges average the pixels they cover. Requires 8-bit
+// input without chroma subsampling. Alpha is averaged as is.
+extern bool dcm_icc_transform_apply_downsampled(const DmcIccTransform *icc_transform,
+                                                const char *frame,
+                                                uint32_t frame_row_stride,
+                                                uint32_t frame_plane_stride,
+                                                const DcmIccRegion *region,
+                                                uint32_t factor,
+                                                DcmIccDownsampleFilter filter,
+                                                char *corrected_frame,
+                                                uint32_t corrected_row_stride,
+                                                uint32_t corrected_plane_stride);
+
 extern void dcm_icc_transform_destroy(DmcIccTransform *icc_transform);
 
+// Transforms are shared through a process-wide cache keyed by the content of
+// the ICC profile, the output type, the rendering intent and the pixel format.
+// The least recently used entries are evicted when the capacity (in bytes)
+// is exceeded; a capacity of 0 disables caching.
+extern void dcm_icc_transform_cache_set_capacity(size_t capacity);
+
+extern size_t dcm_icc_transform_cache_get_capacity(void);
+
+extern size_t dcm_icc_transform_cache_get_size(void);
+
+extern void dcm_icc_transform_cache_clear(void);
+
+extern void dcm_icc_context_options_init(DcmIccContextOptions *options);
+
+// Create a context with its own lcms2 context, transform cache and error
+// callback. Transforms created in different contexts share no mutable state,
+// so they can be created concurrently without contention. A context may be
+// used by several threads at once.
+extern DcmIccContext *dcm_icc_context_create(const DcmIccContextOptions *options);
+
+// Destroy a context, all transforms created in it must be destroyed first
+extern void dcm_icc_context_destroy(DcmIccContext *context);
+
+// Statistics of all transforms of a context created with collect_stats,
+// including transforms destroyed since. Returns false if the context
+// collects none.
+extern bool dcm_icc_context_get_stats(const DcmIccContext *context,
+                                      DcmIccStats *stats);
+
+extern void dcm_icc_context_reset_stats(DcmIccContext *context);
+
+// Directory in which the tables of LUT engines are kept across processes
+// (NULL = none). Tables are written there when first built and mapped by
+// later processes instead of being rebuilt. Tables written to the directory
+// are populated up front. lcms2 pipelines are not stored.
+extern bool dcm_icc_transform_cache_set_directory(const char *directory);
+
+// Create a pool of persistent worker threads (0 = one per online processor).
+// A pool may be shared by any number of concurrent callers.
+extern DcmIccThreadPool *dcm_icc_thread_pool_create(uint32_t number_of_threads);
+
+extern uint32_t dcm_icc_thread_pool_get_number_of_threads(const DcmIccThreadPool *pool);
+
+extern void dcm_icc_thread_pool_destroy(DcmIccThreadPool *pool);
+
+// Same as dcm_icc_transform_apply(), but splits the frame into row stripes
+// that are processed concurrently by the workers of the pool.
+extern void dcm_icc_transform_apply_parallel(const DmcIccTransform *icc_transform,
+                                             DcmIccThreadPool *pool,
+                                             const char *frame,
+                                             uint32_t frame_size,
+                                             char *corrected_frame);
+
+// Transform a frame in place, using the workers of the pool (NULL = calling
+// thread only). Planar frames are supported. Returns false unless the input
+// and output pixel formats of the transform are the same.
+extern bool dcm_icc_transform_apply_in_place(const DmcIccTransform *icc_transform,
+                                             DcmIccThreadPool *pool,
+                                             char *frame,
+                                             uint32_t frame_size);
+
+// Outcome of transforming an item of a batch
+typedef enum {
+    DCM_ICC_BATCH_SUCCESS = 0,
+    DCM_ICC_BATCH_INVALID_ARGUMENT = 1,  // Missing buffer, empty item or odd
+                                         // YBR_FULL_422 width
+    DCM_ICC_BATCH_BUFFER_TOO_SMALL = 2   // Buffer smaller than the pixels
+} DcmIccBatchStatus;
+
+// Frame or tile of a batch, pixels are laid out like the frames of the
+// transform (packed rows, planes following each other if planar)
+typedef struct {
+    const char *frame;
+    uint32_t frame_size;            // Size in bytes of frame
+    char *corrected_frame;
+    uint32_t corrected_frame_size;  // Size in bytes of corrected_frame
+    uint32_t columns;               // 0 = columns of the transform
+    uint32_t rows;                  // 0 = rows of the transform
+    DcmIccBatchStatus status;       // Set by dcm_icc_transform_apply_batch()
+} DcmIccBatchItem;
+
+// Transform a batch of frames or tiles of any size, spreading the work over
+// the workers of the pool (NULL = calling thread only). Items are checked
+// individually; returns the number of items that failed.
+extern uint32_t dcm_icc_transform_apply_batch(const DmcIccTransform *icc_transform,
+                                              DcmIccThreadPool *pool,
+                                              DcmIccBatchItem *items,
+                                              uint32_t number_of_items);
+
+// Receives corrected rows of a stream. Rows are laid out like those of the
+// corrected frame; planes of planar strips are number_of_rows rows apart.
+// The rows are only valid during the call. Return false to abort the stream.
+typedef bool (*DcmIccStreamCallback)(void *user_data,
+                                     const char *corrected_rows,
+                                     uint32_t first_row,
+                                     uint32_t number_of_rows);
+
+// Create a context that transforms frames pushed in pieces of any size and
+// hands the corrected rows to the callback in strips of rows_per_strip rows
+// (0 = whole frame). Memory use is bounded by the size of a strip, except
+// for planar frames, whose planes arrive one after the other: all but the
+// last plane are kept until the last plane arrives.
+extern DcmIccStream *dcm_icc_stream_create(const DmcIccTransform *icc_transform,
+                                           uint32_t rows_per_strip,
+                                           DcmIccStreamCallback callback,
+                                           void *user_data);
+
+// Push the next bytes of the frame, calling back for every completed strip
+extern bool dcm_icc_stream_push(DcmIccStream *stream, const char *data, size_t size);
+
+// End the frame, returns false if it was incomplete or the stream failed.
+// The stream is ready for the next frame afterwards.
+extern bool dcm_icc_stream_finish(DcmIccStream *stream);
+
+extern void dcm_icc_stream_destroy(DcmIccStream *stream);
+
+// Create a stage that colour-corrects pixels as a decoder produces them,
+// e.g. JPEG MCU rows or JPEG 2000 tiles, writing only the corrected frame.
+// Rows go through a scratch buffer of max_rows rows, small enough to stay
+// in cache. A sink is used by one thread at a time.
+extern DcmIccSink *dcm_icc_sink_create(const DmcIccTransform *icc_transform,
+                                       uint32_t max_rows);
+
+// Start a frame that is written to corrected_frame. Zero strides lay it out
+// like the output of dcm_icc_transform_apply(); plane strides only apply to
+// planar pixels.
+extern void dcm_icc_sink_begin(DcmIccSink *sink,
+                               char *corrected_frame,
+                               uint32_t corrected_row_stride,
+                               uint32_t corrected_plane_stride);
+
+// Scratch buffer for the decoder to write up to max_rows rows of input
+// pixels into. Rows are row_stride bytes apart, planes of planar pixels
+// max_rows rows.
+extern char *dcm_icc_sink_get_rows(DcmIccSink *sink, size_t *row_stride);
+
+// Transform the first number_of_rows rows of the scratch buffer into rows
+// first_row onwards of the corrected frame
+extern bool dcm_icc_sink_commit_rows(DcmIccSink *sink,
+                                     uint32_t first_row,
+                                     uint32_t number_of_rows);
+
+// Transform a tile decoded into a buffer of the decoder into the region of
+// the corrected frame. Tile rows are tile_row_stride bytes apart (0 = packed
+// rows), planes of planar tiles region->height rows.
+extern bool dcm_icc_sink_commit_tile(DcmIccSink *sink,
+                                     const char *tile,
+                                     uint32_t tile_row_stride,
+                                     const DcmIccRegion *region);
+
+extern void dcm_icc_sink_destroy(DcmIccSink *sink);
+
+// Create an empty set of transforms for the optical paths of an image, e.g.
+// of the items of the Optical Path Sequence (0048,0105). All transforms are
+// created with the same frame size and options; lut_path is not supported.
+extern DcmIccTransformSet *dcm_icc_transform_set_create(uint16_t columns,
+                                                        uint16_t rows,
+                                                        const DcmIccTransformOptions *options);
+
+// Add the ICC profile of the next optical path (NULL = none) and return the
+// index of the path, or -1 on failure. Paths with identical profiles share a
+// transform, which is created when its profile is first added.
+extern int32_t dcm_icc_transform_set_add(DcmIccTransformSet *set,
+                                         const char *icc_profile,
+                                         uint32_t icc_profile_size);
+
+extern uint32_t dcm_icc_transform_set_get_number_of_paths(const DcmIccTransformSet *set);
+
+// Number of distinct profiles, i.e. of transforms created by the set
+extern uint32_t dcm_icc_transform_set_get_number_of_transforms(const DcmIccTransformSet *set);
+
+// Transform of an optical path, owned by the set. NULL if the index is out
+// of range or the path has no profile.
+extern const DmcIccTransform *dcm_icc_transform_set_get(const DcmIccTransformSet *set,
+                                                        uint32_t optical_path_index);
+
+// Same as dcm_icc_transform_apply() with the transform of an optical path.
+// Returns false if the path has no transform.
+extern bool dcm_icc_transform_set_apply(const DcmIccTransformSet *set,
+                                        uint32_t optical_path_index,
+                                        const char *frame,
+                                        uint32_t frame_size,
+                                        char *corrected_frame);
+
+extern void dcm_icc_transform_set_destroy(DcmIccTransformSet *set);
+
+// Priority of a job, e.g. high for tiles of the visible viewport and low for
+// prefetched tiles. Queued jobs run in order of priority, then submission;
+// running jobs are not interrupted.
+typedef enum {
+    DCM_ICC_PRIORITY_HIGH = 0,
+    DCM_ICC_PRIORITY_NORMAL = 1,
+    DCM_ICC_PRIORITY_LOW = 2
+} DcmIccPriority;
+
+#define DCM_ICC_PRIORITY_LEVELS 3
+
+typedef enum {
+    DCM_ICC_JOB_QUEUED = 0,
+    DCM_ICC_JOB_RUNNING = 1,
+    DCM_ICC_JOB_DONE = 2,
+    DCM_ICC_JOB_CANCELLED = 3
+} DcmIccJobStatus;
+
+// Called once a job is done or cancelled, on a scheduler thread or on the
+// thread that cancelled the job, before dcm_icc_job_wait() returns and the
+// status changes. Must not wait for other jobs.
+typedef void (*DcmIccJobCallback)(void *user_data,
+                                  DcmIccJob *job,
+                                  DcmIccJobStatus status);
+
+// Scheduler creation options, initialize with dcm_icc_scheduler_options_init()
+typedef struct {
+    uint32_t number_of_threads;     // Frames transformed at once, 0 = one
+                                    // per online processor
+    uint32_t max_queued_jobs;       // Jobs waiting to run, 0 = unbounded
+    DcmIccThreadPool *pool;         // Splits each frame into stripes, NULL =
+                                    // frames run on a single thread
+    bool notify_fd;                 // Signal completions through a file
+                                    // descriptor, see dcm_icc_scheduler_get_fd()
+} DcmIccSchedulerOptions;
+
+// Frame to transform asynchronously, the buffers must stay valid until the
+// job is done or cancelled
+typedef struct {
+    const DmcIccTransform *icc_transform;
+    const char *frame;
+    uint32_t frame_size;
+    char *corrected_frame;
+    DcmIccPriority priority;
+    DcmIccJobCallback callback;     // NULL = none
+    void *user_data;                // Passed to the callback
+} DcmIccJobRequest;
+
+extern void dcm_icc_scheduler_options_init(DcmIccSchedulerOptions *options);
+
+// Create a scheduler that transforms frames on its own threads, so that
+// callers such as I/O threads never block on colour correction
+extern DcmIccScheduler *dcm_icc_scheduler_create(const DcmIccSchedulerOptions *options);
+
+// Read end of a non-blocking pipe that receives a byte for every job that is
+// done or cancelled, for poll() and event loops. -1 unless requested.
+extern int dcm_icc_scheduler_get_fd(const DcmIccScheduler *scheduler);
+
+// Queue a job. If the queue is full, waits for a free slot if block is set
+// and returns NULL otherwise, so that callers can shed load. Without worker
+// threads (e.g. WASM builds without pthreads) the job runs before the call
+// returns. The returned handle is released with dcm_icc_job_release().
+extern DcmIccJob *dcm_icc_scheduler_submit(DcmIccScheduler *scheduler,
+                                           const DcmIccJobRequest *request,
+                                           bool block);
+
+// Cancel all queued jobs, wait for running ones and destroy the scheduler.
+// All job handles must be released first.
+extern void dcm_icc_scheduler_destroy(DcmIccScheduler *scheduler);
+
+extern DcmIccJobStatus dcm_icc_job_get_status(const DcmIccJob *job);
+
+// Wait until the job is done or cancelled and its callback has returned
+extern DcmIccJobStatus dcm_icc_job_wait(DcmIccJob *job);
+
+// Cancel a job that has not started yet. Returns false if it is running or
+// finished already.
+extern bool dcm_icc_job_cancel(DcmIccJob *job);
+
+extern void dcm_icc_job_release(DcmIccJob *job);
+
 #endif
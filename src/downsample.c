@@ -0,0 +1,315 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <math.h>
+#include <lcms2.h>
+
+#include "dicomicc.h"
+#include "downsample.h"
+#include "transform.h"
+#include "context.h"
+
+// Largest supported downsampling factor; sums of 8-bit samples over a block
+// stay well within 32 bits
+#define DCM_ICC_DOWNSAMPLE_MAX_FACTOR 16
+
+// Downsampled pixels that are transformed at a time
+#define DCM_ICC_DOWNSAMPLE_BLOCK_PIXELS 16384
+
+#define DCM_ICC_LINEARIZER_MAX_INDEX ((float)(DCM_ICC_LINEARIZER_POINTS - 1))
+
+static const cmsTagSignature trc_tags[3] = {
+    cmsSigRedTRCTag, cmsSigGreenTRCTag, cmsSigBlueTRCTag
+};
+
+static float srgb_to_linear(float value) {
+    return value <= 0.04045f
+        ? value / 12.92f
+        : powf((value + 0.055f) / 1.055f, 2.4f);
+}
+
+static float linear_to_srgb(float value) {
+    return value <= 0.0031308f
+        ? value * 12.92f
+        : 1.055f * powf(value, 1.0f / 2.4f) - 0.055f;
+}
+
+static uint8_t encode(float value) {
+    if (value <= 0.0f) {
+        return 0;
+    }
+    if (value >= 1.0f) {
+        return 255;
+    }
+    return (uint8_t)(value * 255.0f + 0.5f);
+}
+
+bool dcm_icc_linearizer_copy_curves(cmsHPROFILE in_handle, cmsToneCurve *curves[3]) {
+    const bool matrix_shaper = cmsIsMatrixShaper(in_handle);
+    for (int c = 0; c < 3; c++) {
+        // The curves read belong to the profile
+        const cmsToneCurve *curve = matrix_shaper ? cmsReadTag(in_handle, trc_tags[c]) : NULL;
+        curves[c] = curve != NULL ? cmsDupToneCurve(curve) : NULL;
+        if (curve != NULL && curves[c] == NULL) {
+            for (int i = 0; i < c; i++) {
+                cmsFreeToneCurve(curves[i]);
+                curves[i] = NULL;
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+DcmIccLinearizer *dcm_icc_linearizer_create(const DcmIccContext *context,
+                                            cmsToneCurve *const curves[3]) {
+    DcmIccLinearizer *linearizer = dcm_icc_calloc(context, 1, sizeof(DcmIccLinearizer));
+    if (linearizer == NULL) {
+        return NULL;
+    }
+    linearizer->context = context;
+
+    for (int c = 0; c < 3; c++) {
+        const cmsToneCurve *curve = curves[c];
+        cmsToneCurve *reversed = curve != NULL ? cmsReverseToneCurve(curve) : NULL;
+
+        for (uint32_t value = 0; value < 256; value++) {
+            const float sample = (float)value / 255.0f;
+            linearizer->linear[c][value] = reversed != NULL
+                ? cmsEvalToneCurveFloat(curve, sample)
+                : srgb_to_linear(sample);
+        }
+        for (uint32_t i = 0; i < DCM_ICC_LINEARIZER_POINTS; i++) {
+            const float root = (float)i / DCM_ICC_LINEARIZER_MAX_INDEX;
+            linearizer->encoded[c][i] = encode(reversed != NULL
+                ? cmsEvalToneCurveFloat(reversed, root * root)
+                : linear_to_srgb(root * root));
+        }
+
+        if (reversed != NULL) {
+            cmsFreeToneCurve(reversed);
+        }
+    }
+
+    return linearizer;
+}
+
+void dcm_icc_linearizer_destroy(DcmIccLinearizer *linearizer) {
+    if (linearizer) {
+        dcm_icc_free(linearizer->context, linearizer);
+    }
+}
+
+// Source and destination of a downsampling, for one row of output pixels
+typedef struct {
+    const uint8_t *src;
+    size_t src_row_stride;
+    uint32_t src_width;
+    uint32_t src_height;        // Rows of the block, at most the factor
+    uint8_t *dst;
+    uint32_t dst_width;
+    // Offset of each sample from its pixel and distance between pixels,
+    // the same for the source and the destination row but for the planes
+    size_t src_offsets[4];
+    size_t dst_offsets[4];
+    size_t pixel_step;
+    // Colour channel of each sample, 3 for alpha and padding
+    uint8_t channels[4];
+    uint8_t samples_per_pixel;
+} DcmIccDownsampleRow;
+
+/**
+ * Average the samples of each block of factor x factor source pixels,
+ * cropped at the right and bottom edges
+ */
+static void downsample_row(const DcmIccDownsampleRow *row,
+                           uint32_t factor,
+                           const DcmIccLinearizer *linearizer) {
+    for (uint32_t x = 0; x < row->dst_width; x++) {
+        const uint32_t first = x * factor;
+        const uint32_t width = row->src_width - first < factor
+            ? row->src_width - first
+            : factor;
+        const uint32_t count = width * row->src_height;
+        const uint8_t *block = row->src + first * row->pixel_step;
+        uint8_t *pixel = row->dst + x * row->pixel_step;
+
+        for (uint32_t s = 0; s < row->samples_per_pixel; s++) {
+            const uint8_t *samples = block + row->src_offsets[s];
+            const uint8_t channel = row->channels[s];
+
+            if (linearizer != NULL && channel < 3) {
+                const float *linear = linearizer->linear[channel];
+                float sum = 0.0f;
+                for (uint32_t dy = 0; dy < row->src_height; dy++) {
+                    const uint8_t *line = samples + dy * row->src_row_stride;
+                    for (uint32_t dx = 0; dx < width; dx++) {
+                        sum += linear[line[dx * row->pixel_step]];
+                    }
+                }
+                float average = sum / (float)count;
+                if (average > 1.0f) {
+                    average = 1.0f;
+                }
+                const int32_t index = (int32_t)(sqrtf(average) * DCM_ICC_LINEARIZER_MAX_INDEX +
+                                                0.5f);
+                pixel[row->dst_offsets[s]] = linearizer->encoded[channel][index];
+            } else {
+                uint32_t sum = 0;
+                for (uint32_t dy = 0; dy < row->src_height; dy++) {
+                    const uint8_t *line = samples + dy * row->src_row_stride;
+                    for (uint32_t dx = 0; dx < width; dx++) {
+                        sum += line[dx * row->pixel_step];
+                    }
+                }
+                pixel[row->dst_offsets[s]] = (uint8_t)((sum + count / 2) / count);
+            }
+        }
+    }
+}
+
+bool dcm_icc_transform_apply_downsampled(const DmcIccTransform *icc_transform,
+                                         const char *frame,
+                                         uint32_t frame_row_stride,
+                                         uint32_t frame_plane_stride,
+                                         const DcmIccRegion *region,
+                                         uint32_t factor,
+                                         DcmIccDownsampleFilter filter,
+                                         char *corrected_frame,
+                                         uint32_t corrected_row_stride,
+                                         uint32_t corrected_plane_stride) {
+    const DcmIccContext *context = icc_transform->context;
+    const DcmIccFormatInfo *input = icc_transform->input_format;
+    const DcmIccFormatInfo *output = icc_transform->output_format;
+    const DcmIccLinearizer *linearizer = NULL;
+
+    if (factor < 2 || factor > DCM_ICC_DOWNSAMPLE_MAX_FACTOR) {
+        dcm_icc_error(context, "Invalid downsampling factor %u", factor);
+        return false;
+    }
+    if (input->sample_type != DCM_ICC_SAMPLE_UNSIGNED ||
+        input->bytes_per_sample != 1 || input->subsampled) {
+        dcm_icc_error(context, "Downsampling requires 8-bit input without chroma subsampling");
+        return false;
+    }
+    if (filter == DCM_ICC_DOWNSAMPLE_LINEAR) {
+        if (input->ybr) {
+            dcm_icc_error(context, "Linear-light downsampling requires RGB input");
+            return false;
+        }
+        if (icc_transform->pipeline->linearizable) {
+            linearizer = dcm_icc_pipeline_get_linearizer(icc_transform->pipeline);
+        }
+        if (linearizer == NULL) {
+            dcm_icc_error(context, "Failed to create the linear-light curves");
+            return false;
+        }
+    } else if (filter != DCM_ICC_DOWNSAMPLE_BOX) {
+        dcm_icc_error(context, "Unknown downsampling filter %u", (uint32_t)filter);
+        return false;
+    }
+    if (frame_row_stride == 0 &&
+        ((uint64_t)region->x + region->width > icc_transform->columns ||
+         (uint64_t)region->y + region->height > icc_transform->rows)) {
+        dcm_icc_error(context, "Region exceeds the frame");
+        return false;
+    }
+    if (region->width == 0 || region->height == 0) {
+        return true;
+    }
+
+    DcmIccBufferLayout in_layout = icc_transform->input_layout;
+    if (frame_row_stride != 0) {
+        in_layout.row_stride = frame_row_stride;
+        in_layout.plane_stride = frame_plane_stride;
+    }
+
+    const uint32_t width = (region->width + factor - 1) / factor;
+    const uint32_t height = (region->height + factor - 1) / factor;
+    const uint32_t samples_per_pixel = input->samples_per_pixel;
+    const size_t in_pixel_size = icc_transform->planar ? 1 : samples_per_pixel;
+    size_t out_pixel_size = output->bytes_per_sample;
+    if (!icc_transform->planar) {
+        out_pixel_size *= output->samples_per_pixel;
+    }
+
+    DcmIccBufferLayout out_layout;
+    if (corrected_row_stride != 0) {
+        out_layout.row_stride = corrected_row_stride;
+        out_layout.plane_stride = corrected_plane_stride;
+    } else {
+        // Packed output block
+        out_layout.row_stride = width * out_pixel_size;
+        out_layout.plane_stride = icc_transform->planar
+            ? out_layout.row_stride * height
+            : 0;
+    }
+
+    // Downsampled input pixels, laid out like the input of the transform
+    uint32_t block_rows = DCM_ICC_DOWNSAMPLE_BLOCK_PIXELS / width;
+    if (block_rows == 0) {
+        block_rows = 1;
+    }
+    if (block_rows > height) {
+        block_rows = height;
+    }
+    DcmIccBufferLayout block_layout;
+    block_layout.row_stride = width * in_pixel_size;
+    block_layout.plane_stride = icc_transform->planar
+        ? block_layout.row_stride * block_rows
+        : 0;
+    uint8_t *block = dcm_icc_malloc(context,
+                                    (size_t)block_rows * width * samples_per_pixel);
+    if (block == NULL) {
+        dcm_icc_error(context, "Failed to allocate the downsampling buffer");
+        return false;
+    }
+
+    const uint64_t start = dcm_icc_transform_begin_call(icc_transform);
+
+    DcmIccDownsampleRow row = {
+        .src_row_stride = in_layout.row_stride,
+        .src_width = region->width,
+        .dst_width = width,
+        .pixel_step = in_pixel_size,
+        .channels = { 3, 3, 3, 3 },
+        .samples_per_pixel = (uint8_t)samples_per_pixel,
+    };
+    for (uint32_t s = 0; s < samples_per_pixel; s++) {
+        row.src_offsets[s] = icc_transform->planar ? s * in_layout.plane_stride : s;
+        row.dst_offsets[s] = icc_transform->planar ? s * block_layout.plane_stride : s;
+    }
+    for (uint8_t c = 0; c < 3; c++) {
+        row.channels[input->positions[c]] = c;
+    }
+
+    const uint8_t *src = (const uint8_t *)frame +
+                         region->y * in_layout.row_stride +
+                         region->x * in_pixel_size;
+    for (uint32_t y = 0; y < height; y += block_rows) {
+        const uint32_t rows = height - y < block_rows ? height - y : block_rows;
+
+        for (uint32_t i = 0; i < rows; i++) {
+            const uint32_t first = (y + i) * factor;
+            row.src = src + first * in_layout.row_stride;
+            row.src_height = region->height - first < factor
+                ? region->height - first
+                : factor;
+            row.dst = block + i * block_layout.row_stride;
+            downsample_row(&row, factor, linearizer);
+        }
+
+        dcm_icc_transform_block(icc_transform,
+                                (const char *)block,
+                                &block_layout,
+                                corrected_frame + y * out_layout.row_stride,
+                                &out_layout,
+                                width,
+                                rows);
+    }
+
+    dcm_icc_transform_end_call(icc_transform, start, (uint64_t)width * height);
+    dcm_icc_free(context, block);
+
+    return true;
+}
@@ -0,0 +1,44 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <lcms2.h>
+
+#include "dicomicc.h"
+
+#ifndef DCM_ICC_DOWNSAMPLE_INCLUDED
+#define DCM_ICC_DOWNSAMPLE_INCLUDED
+
+// Entries of the encoding curves, indexed by the square root of linear light
+// in [0, 1] like the output curves of the shaper
+#define DCM_ICC_LINEARIZER_POINTS 4096
+
+typedef struct _DcmIccLinearizer DcmIccLinearizer;
+
+/**
+ * Decoding of 8-bit input samples to linear light and back, so that pixels
+ * can be averaged in linear light before they are transformed
+ */
+struct _DcmIccLinearizer {
+    // Context the linearizer is allocated in, NULL for malloc()
+    const DcmIccContext *context;
+    float linear[3][256];
+    uint8_t encoded[3][DCM_ICC_LINEARIZER_POINTS];
+};
+
+/**
+ * Copy the tone reproduction curves of an RGB input profile, so that a
+ * linearizer can be built once the profile is closed. Curves are NULL if
+ * the profile has none, e.g. because it is based on lookup tables.
+ */
+bool dcm_icc_linearizer_copy_curves(cmsHPROFILE in_handle, cmsToneCurve *curves[3]);
+
+/**
+ * Build the curves from copied tone reproduction curves, or from the sRGB
+ * curve where there are none
+ */
+DcmIccLinearizer *dcm_icc_linearizer_create(const DcmIccContext *context,
+                                            cmsToneCurve *const curves[3]);
+
+void dcm_icc_linearizer_destroy(DcmIccLinearizer *linearizer);
+
+#endif
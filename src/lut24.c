@@ -0,0 +1,206 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <lcms2.h>
+
+#include "lut24.h"
+#include "ybr.h"
+#include "context.h"
+
+// Identifies 24-bit table files
+#define DCM_ICC_LUT24_FILE_MAGIC "DCMICCLT"
+
+static DcmIccLut24 *allocate_lut(const DcmIccContext *context) {
+    DcmIccLut24 *lut = dcm_icc_calloc(context, 1, sizeof(DcmIccLut24));
+    if (lut == NULL) {
+        return NULL;
+    }
+
+    lut->context = context;
+    for (int i = 0; i < DCM_ICC_LUT24_LOCKS; i++) {
+        pthread_mutex_init(&lut->locks[i], NULL);
+    }
+    atomic_init(&lut->populated_slabs, 0);
+    lut->size = sizeof(DcmIccLut24) + DCM_ICC_LUT24_TABLE_SIZE;
+
+    return lut;
+}
+
+/**
+ * Replace the YCbCr colours a table is indexed by with the RGB colours the
+ * transform expects
+ */
+static void convert_ybr(uint8_t *colours, uint32_t count) {
+    const uint8_t *const ybr[3] = { colours, colours + 1, colours + 2 };
+    dcm_icc_ybr_to_rgb(ybr, 3, colours, count);
+}
+
+static void populate_slab(DcmIccLut24 *lut, uint32_t slab) {
+    pthread_mutex_t *lock = &lut->locks[slab % DCM_ICC_LUT24_LOCKS];
+
+    pthread_mutex_lock(lock);
+    if (!atomic_load_explicit(&lut->ready[slab], memory_order_acquire)) {
+        uint8_t colours[256 * 3];
+        for (uint32_t b = 0; b < 256; b++) {
+            colours[b * 3] = (uint8_t)(slab >> 8);
+            colours[b * 3 + 1] = (uint8_t)slab;
+            colours[b * 3 + 2] = (uint8_t)b;
+        }
+        if (lut->ybr) {
+            convert_ybr(colours, 256);
+        }
+        cmsDoTransform(lut->handle, colours, lut->table + (size_t)slab * 256 * 3, 256);
+
+        atomic_store_explicit(&lut->ready[slab], 1, memory_order_release);
+        atomic_fetch_add_explicit(&lut->populated_slabs, 1, memory_order_release);
+    }
+    pthread_mutex_unlock(lock);
+}
+
+/**
+ * Populate the whole table, one plane of constant red at a time
+ */
+static bool populate_all(DcmIccLut24 *lut) {
+    uint8_t *colours = dcm_icc_malloc(lut->context, 65536 * 3);
+    if (colours == NULL) {
+        return false;
+    }
+
+    for (uint32_t r = 0; r < 256; r++) {
+        for (uint32_t i = 0; i < 65536; i++) {
+            colours[i * 3] = (uint8_t)r;
+            colours[i * 3 + 1] = (uint8_t)(i >> 8);
+            colours[i * 3 + 2] = (uint8_t)i;
+        }
+        if (lut->ybr) {
+            convert_ybr(colours, 65536);
+        }
+        cmsDoTransform(lut->handle, colours, lut->table + (size_t)r * 65536 * 3, 65536);
+    }
+    dcm_icc_free(lut->context, colours);
+
+    atomic_store_explicit(&lut->populated_slabs, DCM_ICC_LUT24_SLABS,
+                          memory_order_release);
+
+    return true;
+}
+
+DcmIccLut24 *dcm_icc_lut24_create(const DcmIccContext *context,
+                                  cmsHTRANSFORM handle,
+                                  bool ybr,
+                                  bool lazy) {
+    DcmIccLut24 *lut = allocate_lut(context);
+    if (lut == NULL) {
+        cmsDeleteTransform(handle);
+        return NULL;
+    }
+    lut->handle = handle;
+    lut->ybr = ybr;
+
+    lut->table = dcm_icc_malloc(context, DCM_ICC_LUT24_TABLE_SIZE);
+    if (lut->table == NULL) {
+        dcm_icc_lut24_destroy(lut);
+        return NULL;
+    }
+
+    if (lazy) {
+        lut->ready = dcm_icc_calloc(context, DCM_ICC_LUT24_SLABS, sizeof(atomic_uchar));
+        if (lut->ready == NULL) {
+            dcm_icc_lut24_destroy(lut);
+            return NULL;
+        }
+        lut->size += DCM_ICC_LUT24_SLABS * sizeof(atomic_uchar);
+    } else if (!populate_all(lut)) {
+        dcm_icc_lut24_destroy(lut);
+        return NULL;
+    }
+
+    return lut;
+}
+
+static bool is_complete(DcmIccLut24 *lut) {
+    return atomic_load_explicit(&lut->populated_slabs, memory_order_acquire) ==
+           DCM_ICC_LUT24_SLABS;
+}
+
+DcmIccLut24 *dcm_icc_lut24_map(const DcmIccContext *context,
+                               const char *path,
+                               const DcmIccLutFileKey *key) {
+    void *mapping = dcm_icc_lut_file_map(path, DCM_ICC_LUT24_FILE_MAGIC, key,
+                                         DCM_ICC_LUT24_TABLE_SIZE);
+    if (mapping == NULL) {
+        return NULL;
+    }
+
+    DcmIccLut24 *lut = allocate_lut(context);
+    if (lut == NULL) {
+        dcm_icc_lut_file_unmap(mapping, DCM_ICC_LUT24_TABLE_SIZE);
+        return NULL;
+    }
+
+    // Mapped tables are complete and therefore never written to
+    lut->mapping = mapping;
+    lut->table = (uint8_t *)mapping + DCM_ICC_LUT_FILE_HEADER_SIZE;
+    atomic_store(&lut->populated_slabs, DCM_ICC_LUT24_SLABS);
+
+    return lut;
+}
+
+bool dcm_icc_lut24_write(DcmIccLut24 *lut, const char *path, const DcmIccLutFileKey *key) {
+    if (!is_complete(lut)) {
+        for (uint32_t slab = 0; slab < DCM_ICC_LUT24_SLABS; slab++) {
+            if (!atomic_load_explicit(&lut->ready[slab], memory_order_acquire)) {
+                populate_slab(lut, slab);
+            }
+        }
+    }
+
+    return dcm_icc_lut_file_write(lut->context, path, DCM_ICC_LUT24_FILE_MAGIC, key,
+                                  lut->table, DCM_ICC_LUT24_TABLE_SIZE);
+}
+
+void dcm_icc_lut24_apply(DcmIccLut24 *lut,
+                         const uint8_t *const src[3],
+                         size_t src_step,
+                         uint8_t *const dst[3],
+                         size_t dst_step,
+                         uint32_t count) {
+    const uint8_t *table = lut->table;
+    const bool complete = is_complete(lut);
+
+    for (uint32_t i = 0; i < count; i++) {
+        const size_t s = i * src_step;
+        const uint32_t slab = (uint32_t)src[0][s] << 8 | src[1][s];
+
+        if (!complete &&
+            !atomic_load_explicit(&lut->ready[slab], memory_order_acquire)) {
+            populate_slab(lut, slab);
+        }
+
+        const uint8_t *colour = table + ((size_t)slab << 8 | src[2][s]) * 3;
+        const size_t d = i * dst_step;
+        dst[0][d] = colour[0];
+        dst[1][d] = colour[1];
+        dst[2][d] = colour[2];
+    }
+}
+
+void dcm_icc_lut24_destroy(DcmIccLut24 *lut) {
+    if (lut) {
+        if (lut->mapping) {
+            dcm_icc_lut_file_unmap(lut->mapping, DCM_ICC_LUT24_TABLE_SIZE);
+        } else {
+            dcm_icc_free(lut->context, lut->table);
+        }
+        if (lut->handle) {
+            cmsDeleteTransform(lut->handle);
+        }
+        dcm_icc_free(lut->context, lut->ready);
+        for (int i = 0; i < DCM_ICC_LUT24_LOCKS; i++) {
+            pthread_mutex_destroy(&lut->locks[i]);
+        }
+        dcm_icc_free(lut->context, lut);
+    }
+}
@@ -0,0 +1,79 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <lcms2.h>
+
+#include "dicomicc.h"
+#include "lutfile.h"
+
+#ifndef DCM_ICC_LUT24_INCLUDED
+#define DCM_ICC_LUT24_INCLUDED
+
+// The table is populated in slabs of 256 colours sharing red and green
+#define DCM_ICC_LUT24_SLABS 65536
+
+// Number of mutexes guarding the population of slabs
+#define DCM_ICC_LUT24_LOCKS 64
+
+#define DCM_ICC_LUT24_TABLE_SIZE (((size_t)1 << 24) * 3)
+
+typedef struct _DcmIccLut24 DcmIccLut24;
+
+/**
+ * Output colour of every 8-bit RGB input colour, indexed by (R << 16 | G << 8 | B),
+ * or of every YBR_FULL input colour, indexed by (Y << 16 | Cb << 8 | Cr).
+ * The table is either populated up front, populated slab by slab when a
+ * colour is first looked up, or mapped read-only from a file.
+ */
+struct _DcmIccLut24 {
+    // Context the table is allocated in, NULL for malloc()
+    const DcmIccContext *context;
+    uint8_t *table;
+    size_t size;
+    // Transform used to populate slabs, kept until the table is destroyed
+    // because slabs may still be populated concurrently; NULL if mapped
+    cmsHTRANSFORM handle;
+    // Indexed by YBR_FULL colours
+    bool ybr;
+    atomic_uchar *ready;
+    atomic_uint populated_slabs;
+    pthread_mutex_t locks[DCM_ICC_LUT24_LOCKS];
+    // Table file the table is mapped from, if any
+    void *mapping;
+};
+
+/**
+ * Create a table from a TYPE_RGB_8 to TYPE_RGB_8 transform, which is owned
+ * by the table afterwards. Tables indexed by YBR_FULL colours convert them
+ * to RGB before they are transformed.
+ */
+DcmIccLut24 *dcm_icc_lut24_create(const DcmIccContext *context,
+                                  cmsHTRANSFORM handle,
+                                  bool ybr,
+                                  bool lazy);
+
+/**
+ * Map a table written by dcm_icc_lut24_write(). Returns NULL if the file
+ * does not exist or was built for a different key or lcms2 version.
+ */
+DcmIccLut24 *dcm_icc_lut24_map(const DcmIccContext *context,
+                               const char *path,
+                               const DcmIccLutFileKey *key);
+
+/**
+ * Write a table to a file, populating missing slabs first
+ */
+bool dcm_icc_lut24_write(DcmIccLut24 *lut, const char *path, const DcmIccLutFileKey *key);
+
+void dcm_icc_lut24_apply(DcmIccLut24 *lut,
+                         const uint8_t *const src[3],
+                         size_t src_step,
+                         uint8_t *const dst[3],
+                         size_t dst_step,
+                         uint32_t count);
+
+void dcm_icc_lut24_destroy(DcmIccLut24 *lut);
+
+#endif
@@ -0,0 +1,464 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <lcms2.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define DCM_ICC_X86 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#endif
+
+#include "lut3d.h"
+#include "ybr.h"
+#include "context.h"
+
+// Identifies 3D table files
+#define DCM_ICC_LUT3D_FILE_MAGIC "DCMICC3D"
+
+#define DCM_ICC_LUT3D_SHIFT (DCM_ICC_LUT3D_VALUE_SHIFT + DCM_ICC_LUT3D_WEIGHT_SHIFT)
+#define DCM_ICC_LUT3D_ROUND (1 << (DCM_ICC_LUT3D_SHIFT - 1))
+
+// Vertices and weights of the tetrahedron enclosing an input colour
+typedef struct {
+    const int16_t *vertices[4];
+    int32_t weights[4];
+} DcmIccTetrahedron;
+
+/**
+ * Split the cube cell enclosing (r, g, b) into six tetrahedra along its main
+ * diagonal and select the one containing the input colour.
+ */
+static inline void select_tetrahedron(const DcmIccLut3d *lut,
+                                      uint8_t r,
+                                      uint8_t g,
+                                      uint8_t b,
+                                      DcmIccTetrahedron *tetrahedron) {
+    const int32_t fr = lut->weights[0][r];
+    const int32_t fg = lut->weights[1][g];
+    const int32_t fb = lut->weights[2][b];
+    const uint32_t sr = lut->strides[0];
+    const uint32_t sg = lut->strides[1];
+    const uint32_t sb = lut->strides[2];
+    const int16_t *base = lut->table +
+                          lut->offsets[0][r] +
+                          lut->offsets[1][g] +
+                          lut->offsets[2][b];
+    int32_t *w = tetrahedron->weights;
+    uint32_t first;
+    uint32_t second;
+
+    if (fr >= fg) {
+        if (fg >= fb) {
+            first = sr;
+            second = sr + sg;
+            w[0] = DCM_ICC_LUT3D_WEIGHT_ONE - fr; w[1] = fr - fg; w[2] = fg - fb; w[3] = fb;
+        } else if (fr >= fb) {
+            first = sr;
+            second = sr + sb;
+            w[0] = DCM_ICC_LUT3D_WEIGHT_ONE - fr; w[1] = fr - fb; w[2] = fb - fg; w[3] = fg;
+        } else {
+            first = sb;
+            second = sr + sb;
+            w[0] = DCM_ICC_LUT3D_WEIGHT_ONE - fb; w[1] = fb - fr; w[2] = fr - fg; w[3] = fg;
+        }
+    } else {
+        if (fb >= fg) {
+            first = sb;
+            second = sg + sb;
+            w[0] = DCM_ICC_LUT3D_WEIGHT_ONE - fb; w[1] = fb - fg; w[2] = fg - fr; w[3] = fr;
+        } else if (fb >= fr) {
+            first = sg;
+            second = sg + sb;
+            w[0] = DCM_ICC_LUT3D_WEIGHT_ONE - fg; w[1] = fg - fb; w[2] = fb - fr; w[3] = fr;
+        } else {
+            first = sg;
+            second = sr + sg;
+            w[0] = DCM_ICC_LUT3D_WEIGHT_ONE - fg; w[1] = fg - fr; w[2] = fr - fb; w[3] = fb;
+        }
+    }
+
+    tetrahedron->vertices[0] = base;
+    tetrahedron->vertices[1] = base + first;
+    tetrahedron->vertices[2] = base + second;
+    tetrahedron->vertices[3] = base + sr + sg + sb;
+}
+
+static inline void select_pixel(const DcmIccLut3d *lut,
+                                const uint8_t *const src[3],
+                                size_t offset,
+                                DcmIccTetrahedron *tetrahedron) {
+    select_tetrahedron(lut,
+                       src[0][offset],
+                       src[1][offset],
+                       src[2][offset],
+                       tetrahedron);
+}
+
+static inline uint32_t pack_weights(int32_t low, int32_t high) {
+    return (uint32_t)low | ((uint32_t)high << 16);
+}
+
+static inline void store_pixel(uint8_t *const dst[3], size_t offset, uint32_t pixel) {
+    dst[0][offset] = (uint8_t)pixel;
+    dst[1][offset] = (uint8_t)(pixel >> 8);
+    dst[2][offset] = (uint8_t)(pixel >> 16);
+}
+
+static void kernel_scalar(const DcmIccLut3d *lut,
+                          const uint8_t *const src[3],
+                          size_t src_step,
+                          uint8_t *const dst[3],
+                          size_t dst_step,
+                          uint32_t count) {
+    DcmIccTetrahedron t;
+
+    for (uint32_t i = 0; i < count; i++) {
+        select_pixel(lut, src, i * src_step, &t);
+        for (int c = 0; c < 3; c++) {
+            const int32_t sum = t.weights[0] * t.vertices[0][c] +
+                                t.weights[1] * t.vertices[1][c] +
+                                t.weights[2] * t.vertices[2][c] +
+                                t.weights[3] * t.vertices[3][c];
+            dst[c][i * dst_step] =
+                (uint8_t)((sum + DCM_ICC_LUT3D_ROUND) >> DCM_ICC_LUT3D_SHIFT);
+        }
+    }
+}
+
+#if defined(DCM_ICC_X86) && defined(__SSE2__)
+static void kernel_sse2(const DcmIccLut3d *lut,
+                        const uint8_t *const src[3],
+                        size_t src_step,
+                        uint8_t *const dst[3],
+                        size_t dst_step,
+                        uint32_t count) {
+    const __m128i round = _mm_set1_epi32(DCM_ICC_LUT3D_ROUND);
+    DcmIccTetrahedron t;
+
+    for (uint32_t i = 0; i < count; i++) {
+        select_pixel(lut, src, i * src_step, &t);
+
+        // Interleave the channels of vertex pairs, so that a single
+        // multiply-add weights and sums two vertices per channel
+        const __m128i v01 = _mm_unpacklo_epi16(
+            _mm_loadl_epi64((const __m128i *)t.vertices[0]),
+            _mm_loadl_epi64((const __m128i *)t.vertices[1]));
+        const __m128i v23 = _mm_unpacklo_epi16(
+            _mm_loadl_epi64((const __m128i *)t.vertices[2]),
+            _mm_loadl_epi64((const __m128i *)t.vertices[3]));
+        const __m128i w01 = _mm_set1_epi32((int32_t)pack_weights(t.weights[0], t.weights[1]));
+        const __m128i w23 = _mm_set1_epi32((int32_t)pack_weights(t.weights[2], t.weights[3]));
+
+        __m128i sum = _mm_add_epi32(_mm_madd_epi16(v01, w01),
+                                    _mm_madd_epi16(v23, w23));
+        sum = _mm_srai_epi32(_mm_add_epi32(sum, round), DCM_ICC_LUT3D_SHIFT);
+        sum = _mm_packs_epi32(sum, sum);
+        sum = _mm_packus_epi16(sum, sum);
+
+        store_pixel(dst, i * dst_step, (uint32_t)_mm_cvtsi128_si32(sum));
+    }
+}
+#endif
+
+#if defined(DCM_ICC_X86)
+__attribute__((target("avx2")))
+static inline __m256i load_vertex_pair(const int16_t *first, const int16_t *second) {
+    return _mm256_inserti128_si256(
+        _mm256_castsi128_si256(_mm_loadl_epi64((const __m128i *)first)),
+        _mm_loadl_epi64((const __m128i *)second),
+        1);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i broadcast_weight_pair(uint32_t first, uint32_t second) {
+    return _mm256_inserti128_si256(
+        _mm256_castsi128_si256(_mm_set1_epi32((int32_t)first)),
+        _mm_set1_epi32((int32_t)second),
+        1);
+}
+
+__attribute__((target("avx2")))
+static void kernel_avx2(const DcmIccLut3d *lut,
+                        const uint8_t *const src[3],
+                        size_t src_step,
+                        uint8_t *const dst[3],
+                        size_t dst_step,
+                        uint32_t count) {
+    const __m256i round = _mm256_set1_epi32(DCM_ICC_LUT3D_ROUND);
+    DcmIccTetrahedron a;
+    DcmIccTetrahedron b;
+    uint32_t i = 0;
+
+    // Two pixels per iteration, one in each 128-bit lane
+    for (; i + 2 <= count; i += 2) {
+        select_pixel(lut, src, i * src_step, &a);
+        select_pixel(lut, src, (i + 1) * src_step, &b);
+
+        const __m256i v01 = _mm256_unpacklo_epi16(
+            load_vertex_pair(a.vertices[0], b.vertices[0]),
+            load_vertex_pair(a.vertices[1], b.vertices[1]));
+        const __m256i v23 = _mm256_unpacklo_epi16(
+            load_vertex_pair(a.vertices[2], b.vertices[2]),
+            load_vertex_pair(a.vertices[3], b.vertices[3]));
+        const __m256i w01 = broadcast_weight_pair(
+            pack_weights(a.weights[0], a.weights[1]),
+            pack_weights(b.weights[0], b.weights[1]));
+        const __m256i w23 = broadcast_weight_pair(
+            pack_weights(a.weights[2], a.weights[3]),
+            pack_weights(b.weights[2], b.weights[3]));
+
+        __m256i sum = _mm256_add_epi32(_mm256_madd_epi16(v01, w01),
+                                       _mm256_madd_epi16(v23, w23));
+        sum = _mm256_srai_epi32(_mm256_add_epi32(sum, round), DCM_ICC_LUT3D_SHIFT);
+        sum = _mm256_packs_epi32(sum, sum);
+        sum = _mm256_packus_epi16(sum, sum);
+
+        store_pixel(dst, i * dst_step,
+                    (uint32_t)_mm_cvtsi128_si32(_mm256_castsi256_si128(sum)));
+        store_pixel(dst, (i + 1) * dst_step,
+                    (uint32_t)_mm_cvtsi128_si32(_mm256_extracti128_si256(sum, 1)));
+    }
+
+    if (i < count) {
+        const uint8_t *const tail_src[3] = {
+            src[0] + i * src_step,
+            src[1] + i * src_step,
+            src[2] + i * src_step,
+        };
+        uint8_t *const tail_dst[3] = {
+            dst[0] + i * dst_step,
+            dst[1] + i * dst_step,
+            dst[2] + i * dst_step,
+        };
+        kernel_scalar(lut, tail_src, src_step, tail_dst, dst_step, count - i);
+    }
+}
+#endif
+
+#if defined(__ARM_NEON)
+static void kernel_neon(const DcmIccLut3d *lut,
+                        const uint8_t *const src[3],
+                        size_t src_step,
+                        uint8_t *const dst[3],
+                        size_t dst_step,
+                        uint32_t count) {
+    DcmIccTetrahedron t;
+
+    for (uint32_t i = 0; i < count; i++) {
+        select_pixel(lut, src, i * src_step, &t);
+
+        // Table values and weights are non-negative, so unsigned widening
+        // multiply-accumulate yields the same result as the signed form
+        uint32x4_t sum = vmull_n_u16(vld1_u16((const uint16_t *)t.vertices[0]),
+                                     (uint16_t)t.weights[0]);
+        sum = vmlal_n_u16(sum, vld1_u16((const uint16_t *)t.vertices[1]),
+                          (uint16_t)t.weights[1]);
+        sum = vmlal_n_u16(sum, vld1_u16((const uint16_t *)t.vertices[2]),
+                          (uint16_t)t.weights[2]);
+        sum = vmlal_n_u16(sum, vld1_u16((const uint16_t *)t.vertices[3]),
+                          (uint16_t)t.weights[3]);
+
+        const uint16x4_t narrow = vrshrn_n_u32(sum, DCM_ICC_LUT3D_SHIFT);
+        const uint8x8_t pixel = vqmovn_u16(vcombine_u16(narrow, narrow));
+
+        dst[0][i * dst_step] = vget_lane_u8(pixel, 0);
+        dst[1][i * dst_step] = vget_lane_u8(pixel, 1);
+        dst[2][i * dst_step] = vget_lane_u8(pixel, 2);
+    }
+}
+#endif
+
+#if defined(__wasm_simd128__)
+static void kernel_wasm_simd128(const DcmIccLut3d *lut,
+                                const uint8_t *const src[3],
+                                size_t src_step,
+                                uint8_t *const dst[3],
+                                size_t dst_step,
+                                uint32_t count) {
+    const v128_t round = wasm_i32x4_splat(DCM_ICC_LUT3D_ROUND);
+    DcmIccTetrahedron t;
+
+    for (uint32_t i = 0; i < count; i++) {
+        select_pixel(lut, src, i * src_step, &t);
+
+        const v128_t v01 = wasm_i16x8_shuffle(wasm_v128_load64_zero(t.vertices[0]),
+                                              wasm_v128_load64_zero(t.vertices[1]),
+                                              0, 8, 1, 9, 2, 10, 3, 11);
+        const v128_t v23 = wasm_i16x8_shuffle(wasm_v128_load64_zero(t.vertices[2]),
+                                              wasm_v128_load64_zero(t.vertices[3]),
+                                              0, 8, 1, 9, 2, 10, 3, 11);
+        const v128_t w01 = wasm_i32x4_splat((int32_t)pack_weights(t.weights[0], t.weights[1]));
+        const v128_t w23 = wasm_i32x4_splat((int32_t)pack_weights(t.weights[2], t.weights[3]));
+
+        v128_t sum = wasm_i32x4_add(wasm_i32x4_dot_i16x8(v01, w01),
+                                    wasm_i32x4_dot_i16x8(v23, w23));
+        sum = wasm_i32x4_shr(wasm_i32x4_add(sum, round), DCM_ICC_LUT3D_SHIFT);
+        sum = wasm_u16x8_narrow_i32x4(sum, sum);
+        sum = wasm_u8x16_narrow_i16x8(sum, sum);
+
+        store_pixel(dst, i * dst_step, (uint32_t)wasm_i32x4_extract_lane(sum, 0));
+    }
+}
+#endif
+
+/**
+ * Pick the fastest kernel supported by the processor we are running on
+ */
+static void select_kernel(DcmIccLut3d *lut) {
+    lut->kernel = kernel_scalar;
+    lut->kernel_name = "lut3d-scalar";
+
+#if defined(DCM_ICC_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        lut->kernel = kernel_avx2;
+        lut->kernel_name = "lut3d-avx2";
+        return;
+    }
+#if defined(__SSE2__)
+    lut->kernel = kernel_sse2;
+    lut->kernel_name = "lut3d-sse2";
+#endif
+#elif defined(__ARM_NEON)
+    lut->kernel = kernel_neon;
+    lut->kernel_name = "lut3d-neon";
+#elif defined(__wasm_simd128__)
+    lut->kernel = kernel_wasm_simd128;
+    lut->kernel_name = "lut3d-wasm-simd128";
+#endif
+}
+
+/**
+ * Allocate a table with the given number of grid points, without values
+ */
+static DcmIccLut3d *allocate_lut(const DcmIccContext *context, uint32_t grid_points) {
+    if (grid_points < 2 || grid_points > 256) {
+        return NULL;
+    }
+
+    const uint32_t n = grid_points;
+
+    DcmIccLut3d *lut = dcm_icc_calloc(context, 1, sizeof(DcmIccLut3d));
+    if (lut == NULL) {
+        return NULL;
+    }
+
+    lut->context = context;
+    lut->grid_points = n;
+    lut->strides[0] = n * n * 4;
+    lut->strides[1] = n * 4;
+    lut->strides[2] = 4;
+    lut->table_size = (size_t)n * n * n * 4 * sizeof(int16_t);
+    lut->size = sizeof(DcmIccLut3d) + lut->table_size;
+
+    // Position of each 8-bit input value on the grid: the lower grid point
+    // and the distance to it. The last value is attributed to the last cell,
+    // so that the upper neighbour always exists.
+    for (uint32_t value = 0; value < 256; value++) {
+        uint32_t position = value * (n - 1);
+        uint32_t index = position / 255;
+        uint32_t weight = ((position % 255) * DCM_ICC_LUT3D_WEIGHT_ONE + 127) / 255;
+        if (index == n - 1) {
+            index = n - 2;
+            weight = DCM_ICC_LUT3D_WEIGHT_ONE;
+        }
+        for (int c = 0; c < 3; c++) {
+            lut->offsets[c][value] = index * lut->strides[c];
+            lut->weights[c][value] = (uint16_t)weight;
+        }
+    }
+
+    select_kernel(lut);
+
+    return lut;
+}
+
+DcmIccLut3d *dcm_icc_lut3d_create(const DcmIccContext *context,
+                                  cmsHTRANSFORM transform,
+                                  uint32_t grid_points,
+                                  bool ybr) {
+    DcmIccLut3d *lut = allocate_lut(context, grid_points);
+    if (lut == NULL) {
+        return NULL;
+    }
+
+    const uint32_t n = grid_points;
+    const size_t number_of_entries = (size_t)n * n * n;
+
+    lut->table = dcm_icc_calloc(context, number_of_entries * 4, sizeof(int16_t));
+    uint16_t *samples = dcm_icc_malloc(context, number_of_entries * 3 * sizeof(uint16_t));
+    if (lut->table == NULL || samples == NULL) {
+        dcm_icc_free(context, samples);
+        dcm_icc_lut3d_destroy(lut);
+        return NULL;
+    }
+
+    size_t i = 0;
+    for (uint32_t r = 0; r < n; r++) {
+        for (uint32_t g = 0; g < n; g++) {
+            for (uint32_t b = 0; b < n; b++) {
+                samples[i++] = (uint16_t)((r * 65535 + (n - 1) / 2) / (n - 1));
+                samples[i++] = (uint16_t)((g * 65535 + (n - 1) / 2) / (n - 1));
+                samples[i++] = (uint16_t)((b * 65535 + (n - 1) / 2) / (n - 1));
+            }
+        }
+    }
+
+    if (ybr) {
+        dcm_icc_ybr_to_rgb_16(samples, number_of_entries);
+    }
+    cmsDoTransform(transform, samples, samples, (cmsUInt32Number)number_of_entries);
+
+    for (i = 0; i < number_of_entries; i++) {
+        for (int c = 0; c < 3; c++) {
+            const uint64_t value = samples[i * 3 + c];
+            lut->table[i * 4 + c] = (int16_t)(
+                (value * (255 << DCM_ICC_LUT3D_VALUE_SHIFT) + 32767) / 65535);
+        }
+    }
+    dcm_icc_free(context, samples);
+
+    return lut;
+}
+
+DcmIccLut3d *dcm_icc_lut3d_map(const DcmIccContext *context,
+                               const char *path,
+                               const DcmIccLutFileKey *key,
+                               uint32_t grid_points) {
+    DcmIccLut3d *lut = allocate_lut(context, grid_points);
+    if (lut == NULL) {
+        return NULL;
+    }
+
+    lut->mapping = dcm_icc_lut_file_map(path, DCM_ICC_LUT3D_FILE_MAGIC, key,
+                                        lut->table_size);
+    if (lut->mapping == NULL) {
+        dcm_icc_free(context, lut);
+        return NULL;
+    }
+    lut->table = (int16_t *)((char *)lut->mapping + DCM_ICC_LUT_FILE_HEADER_SIZE);
+
+    return lut;
+}
+
+bool dcm_icc_lut3d_write(const DcmIccLut3d *lut,
+                         const char *path,
+                         const DcmIccLutFileKey *key) {
+    return dcm_icc_lut_file_write(lut->context, path, DCM_ICC_LUT3D_FILE_MAGIC, key,
+                                  lut->table, lut->table_size);
+}
+
+void dcm_icc_lut3d_destroy(DcmIccLut3d *lut) {
+    if (lut) {
+        if (lut->mapping) {
+            dcm_icc_lut_file_unmap(lut->mapping, lut->table_size);
+        } else {
+            dcm_icc_free(lut->context, lut->table);
+        }
+        dcm_icc_free(lut->context, lut);
+    }
+}
@@ -0,0 +1,79 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <lcms2.h>
+
+#include "dicomicc.h"
+#include "lutfile.h"
+
+#ifndef DCM_ICC_LUT3D_INCLUDED
+#define DCM_ICC_LUT3D_INCLUDED
+
+// Table values are 8-bit output values scaled by 2^DCM_ICC_LUT3D_VALUE_SHIFT,
+// interpolation weights are in units of 1/DCM_ICC_LUT3D_WEIGHT_ONE. Values
+// and weights both fit into signed 16-bit lanes so that kernels can use
+// 16-bit multiply-add instructions.
+#define DCM_ICC_LUT3D_VALUE_SHIFT 7
+#define DCM_ICC_LUT3D_WEIGHT_SHIFT 8
+#define DCM_ICC_LUT3D_WEIGHT_ONE (1 << DCM_ICC_LUT3D_WEIGHT_SHIFT)
+
+typedef struct _DcmIccLut3d DcmIccLut3d;
+
+// Transform count pixels, where sample c of pixel i is read from
+// src[c][i * src_step] and written to dst[c][i * dst_step]
+typedef void (*DcmIccLut3dKernel)(const DcmIccLut3d *lut,
+                                  const uint8_t *const src[3],
+                                  size_t src_step,
+                                  uint8_t *const dst[3],
+                                  size_t dst_step,
+                                  uint32_t count);
+
+/**
+ * Dense 3D lookup table over the 8-bit RGB (or YBR_FULL) input cube,
+ * evaluated with tetrahedral interpolation. Each grid point holds four
+ * 16-bit values (R, G, B and padding), so a vertex is a single 64-bit load.
+ */
+struct _DcmIccLut3d {
+    // Context the table is allocated in, NULL for malloc()
+    const DcmIccContext *context;
+    uint32_t grid_points;
+    // Offset of the lower grid point and interpolation weight per input value
+    uint32_t offsets[3][256];
+    uint16_t weights[3][256];
+    // Distance between neighbouring grid points along each axis
+    uint32_t strides[3];
+    int16_t *table;
+    size_t table_size;
+    size_t size;
+    // Table file the table is mapped from, if any
+    void *mapping;
+    DcmIccLut3dKernel kernel;
+    const char *kernel_name;
+};
+
+/**
+ * Bake a lookup table by evaluating a TYPE_RGB_16 to TYPE_RGB_16 transform
+ * at every grid point. The grid of tables over YBR_FULL colours is
+ * converted to RGB first.
+ */
+DcmIccLut3d *dcm_icc_lut3d_create(const DcmIccContext *context,
+                                  cmsHTRANSFORM transform,
+                                  uint32_t grid_points,
+                                  bool ybr);
+
+/**
+ * Map a table written by dcm_icc_lut3d_write(). Returns NULL if the file
+ * does not exist or was built for a different key or lcms2 version.
+ */
+DcmIccLut3d *dcm_icc_lut3d_map(const DcmIccContext *context,
+                               const char *path,
+                               const DcmIccLutFileKey *key,
+                               uint32_t grid_points);
+
+bool dcm_icc_lut3d_write(const DcmIccLut3d *lut,
+                         const char *path,
+                         const DcmIccLutFileKey *key);
+
+void dcm_icc_lut3d_destroy(DcmIccLut3d *lut);
+
+#endif
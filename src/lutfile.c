@@ -0,0 +1,121 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <lcms2.h>
+
+#include "lutfile.h"
+#include "context.h"
+
+#define DCM_ICC_LUT_FILE_VERSION 3
+
+// Distinguishes the temporary files of concurrent writers within a process
+static atomic_uint temporary_file_counter;
+
+/**
+ * Header of a table file. Fields are stored in native byte order, files are
+ * meant to be shared between processes on the same host.
+ */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t lcms_version;
+    uint64_t table_size;
+    DcmIccLutFileKey key;
+} DcmIccLutFileHeader;
+
+_Static_assert(sizeof(DcmIccLutFileHeader) == DCM_ICC_LUT_FILE_HEADER_SIZE,
+               "unexpected table file header size");
+
+void *dcm_icc_lut_file_map(const char *path,
+                           const char *magic,
+                           const DcmIccLutFileKey *key,
+                           size_t table_size) {
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat status;
+    const size_t mapping_size = DCM_ICC_LUT_FILE_HEADER_SIZE + table_size;
+    if (fstat(fd, &status) != 0 || (size_t)status.st_size != mapping_size) {
+        close(fd);
+        return NULL;
+    }
+
+    void *mapping = mmap(NULL, mapping_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return NULL;
+    }
+
+    const DcmIccLutFileHeader *header = mapping;
+    if (memcmp(header->magic, magic, 8) != 0 ||
+        header->version != DCM_ICC_LUT_FILE_VERSION ||
+        header->lcms_version != LCMS_VERSION ||
+        header->table_size != table_size ||
+        memcmp(&header->key, key, sizeof(DcmIccLutFileKey)) != 0) {
+        munmap(mapping, mapping_size);
+        return NULL;
+    }
+
+    return mapping;
+}
+
+void dcm_icc_lut_file_unmap(void *mapping, size_t table_size) {
+    if (mapping) {
+        munmap(mapping, DCM_ICC_LUT_FILE_HEADER_SIZE + table_size);
+    }
+}
+
+bool dcm_icc_lut_file_write(const DcmIccContext *context,
+                            const char *path,
+                            const char *magic,
+                            const DcmIccLutFileKey *key,
+                            const void *table,
+                            size_t table_size) {
+    DcmIccLutFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, magic, 8);
+    header.version = DCM_ICC_LUT_FILE_VERSION;
+    header.lcms_version = LCMS_VERSION;
+    header.table_size = table_size;
+    header.key = *key;
+
+    // Write to a temporary file and rename it, so that other processes never
+    // map a partially written table
+    const size_t temporary_path_size = strlen(path) + 32;
+    char *temporary_path = malloc(temporary_path_size);
+    if (temporary_path == NULL) {
+        return false;
+    }
+    snprintf(temporary_path, temporary_path_size, "%s.%ld.%u.tmp", path, (long)getpid(),
+             atomic_fetch_add(&temporary_file_counter, 1));
+
+    FILE *file = fopen(temporary_path, "wb");
+    if (file == NULL) {
+        dcm_icc_error(context, "Failed to open LUT file '%s'", temporary_path);
+        free(temporary_path);
+        return false;
+    }
+
+    bool success = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                   fwrite(table, table_size, 1, file) == 1;
+    success = fclose(file) == 0 && success;
+    if (success) {
+        success = rename(temporary_path, path) == 0;
+    }
+    if (!success) {
+        dcm_icc_error(context, "Failed to write LUT file '%s'", path);
+        remove(temporary_path);
+    }
+    free(temporary_path);
+
+    return success;
+}
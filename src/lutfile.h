@@ -0,0 +1,52 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "dicomicc.h"
+
+#ifndef DCM_ICC_LUTFILE_INCLUDED
+#define DCM_ICC_LUTFILE_INCLUDED
+
+// Tables start this many bytes into a table file, which keeps them aligned
+// when the file is mapped
+#define DCM_ICC_LUT_FILE_HEADER_SIZE 64
+
+// Identifies the transform a table file was built for
+typedef struct {
+    uint64_t profile_hash;
+    uint64_t output_profile_hash;
+    uint32_t profile_size;
+    uint32_t output_type;
+    uint32_t intent;
+    uint32_t input_format;
+    uint32_t lut_grid_points;
+    uint32_t reserved;
+} DcmIccLutFileKey;
+
+/**
+ * Map a table file read-only. Returns the mapping, with the table at
+ * DCM_ICC_LUT_FILE_HEADER_SIZE, or NULL if the file does not exist or was
+ * written for a different kind of table, key, table size or lcms2 version.
+ */
+void *dcm_icc_lut_file_map(const char *path,
+                           const char *magic,
+                           const DcmIccLutFileKey *key,
+                           size_t table_size);
+
+/**
+ * Unmap a table file mapped with dcm_icc_lut_file_map()
+ */
+void dcm_icc_lut_file_unmap(void *mapping, size_t table_size);
+
+/**
+ * Write a table file atomically, so that other processes never map a
+ * partially written table. magic identifies the kind of table (8 bytes).
+ */
+bool dcm_icc_lut_file_write(const DcmIccContext *context,
+                            const char *path,
+                            const char *magic,
+                            const DcmIccLutFileKey *key,
+                            const void *table,
+                            size_t table_size);
+
+#endif
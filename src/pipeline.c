@@ -0,0 +1,101 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <lcms2.h>
+
+#include "dicomicc.h"
+#include "pipeline.h"
+#include "context.h"
+#include "lut3d.h"
+#include "lut24.h"
+#include "shaper.h"
+#include "downsample.h"
+
+/**
+ * 64-bit FNV-1a hash
+ */
+uint64_t dcm_icc_hash(const void *data, size_t size) {
+    const unsigned char *bytes = data;
+    uint64_t hash = UINT64_C(0xcbf29ce484222325);
+
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= UINT64_C(0x100000001b3);
+    }
+
+    return hash;
+}
+
+DcmIccPipeline *dcm_icc_pipeline_create(const DcmIccContext *context,
+                                        const DcmIccPipelineKey *key,
+                                        cmsHTRANSFORM handle) {
+    DcmIccPipeline *pipeline = dcm_icc_calloc(context, 1, sizeof(DcmIccPipeline));
+    if (pipeline == NULL) {
+        return NULL;
+    }
+
+    pipeline->context = context;
+    pipeline->key = *key;
+    pipeline->handle = handle;
+    pipeline->size = sizeof(DcmIccPipeline);
+    if (handle != NULL) {
+        pipeline->size += DCM_ICC_PIPELINE_SIZE_ESTIMATE;
+    }
+    atomic_init(&pipeline->references, 1);
+
+    return pipeline;
+}
+
+DcmIccPipeline *dcm_icc_pipeline_retain(DcmIccPipeline *pipeline) {
+    atomic_fetch_add_explicit(&pipeline->references, 1, memory_order_relaxed);
+    return pipeline;
+}
+
+void dcm_icc_pipeline_release(DcmIccPipeline *pipeline) {
+    if (pipeline == NULL) {
+        return;
+    }
+    if (atomic_fetch_sub_explicit(&pipeline->references, 1,
+                                  memory_order_acq_rel) != 1) {
+        return;
+    }
+
+    if (pipeline->handle) {
+        cmsDeleteTransform(pipeline->handle);
+    }
+    dcm_icc_lut3d_destroy(pipeline->lut3d);
+    dcm_icc_lut24_destroy(pipeline->lut24);
+    dcm_icc_shaper_destroy(pipeline->shaper);
+    dcm_icc_linearizer_destroy(atomic_load_explicit(&pipeline->linearizer,
+                                                    memory_order_acquire));
+    for (int c = 0; c < 3; c++) {
+        if (pipeline->input_curves[c] != NULL) {
+            cmsFreeToneCurve(pipeline->input_curves[c]);
+        }
+    }
+    dcm_icc_free(pipeline->context, pipeline);
+}
+
+const DcmIccLinearizer *dcm_icc_pipeline_get_linearizer(DcmIccPipeline *pipeline) {
+    DcmIccLinearizer *linearizer = atomic_load_explicit(&pipeline->linearizer,
+                                                        memory_order_acquire);
+    if (linearizer != NULL) {
+        return linearizer;
+    }
+
+    // Threads racing for the first use may each build one, only the first
+    // one stored is kept
+    DcmIccLinearizer *created = dcm_icc_linearizer_create(pipeline->context,
+                                                          pipeline->input_curves);
+    if (created == NULL) {
+        return NULL;
+    }
+    if (!atomic_compare_exchange_strong_explicit(&pipeline->linearizer,
+                                                 &linearizer, created,
+                                                 memory_order_acq_rel,
+                                                 memory_order_acquire)) {
+        dcm_icc_linearizer_destroy(created);
+        return linearizer;
+    }
+    return created;
+}
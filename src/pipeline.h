@@ -0,0 +1,110 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <lcms2.h>
+
+#include "dicomicc.h"
+#include "lut3d.h"
+#include "lut24.h"
+#include "shaper.h"
+#include "downsample.h"
+
+#ifndef DCM_ICC_PIPELINE_INCLUDED
+#define DCM_ICC_PIPELINE_INCLUDED
+
+// Rough size of an optimised lcms2 pipeline for RGB data (33^3 grid points
+// with three 16-bit output channels), used to account cached transforms.
+#define DCM_ICC_PIPELINE_SIZE_ESTIMATE (33 * 33 * 33 * 3 * 2)
+
+// Everything a compiled lcms2 transform depends on
+typedef struct {
+    uint64_t profile_hash;
+    uint32_t profile_size;
+    DcmIccOutputType output_type;
+    uint64_t output_profile_hash;
+    uint32_t intent;
+    uint32_t input_format;
+    uint32_t output_format;
+    uint32_t flags;
+    DcmIccEngine engine;
+    uint32_t lut_grid_points;
+    bool fast_paths;
+} DcmIccPipelineKey;
+
+typedef struct _DcmIccPipeline DcmIccPipeline;
+
+/**
+ * Compiled colour transform, shared by all transforms with the same key.
+ * The pipeline is immutable once created, but for the linearizer, and freed
+ * with its last reference.
+ */
+struct _DcmIccPipeline {
+    // Context the pipeline is allocated in, NULL for malloc()
+    const DcmIccContext *context;
+    DcmIccPipelineKey key;
+    cmsHTRANSFORM handle;
+    DcmIccLut3d *lut3d;
+    DcmIccLut24 *lut24;
+    DcmIccShaper *shaper;
+    // Class of the colour mapping, whether or not the shaper evaluates it
+    DcmIccTransformClass transform_class;
+    // Tone curves of 8-bit RGB input, NULL where the profile has none, and
+    // the linear light built from them on the first linear downsampling
+    bool linearizable;
+    cmsToneCurve *input_curves[3];
+    _Atomic(DcmIccLinearizer *) linearizer;
+    size_t size;
+    atomic_uint references;
+};
+
+uint64_t dcm_icc_hash(const void *data, size_t size);
+
+DcmIccPipeline *dcm_icc_pipeline_create(const DcmIccContext *context,
+                                        const DcmIccPipelineKey *key,
+                                        cmsHTRANSFORM handle);
+
+DcmIccPipeline *dcm_icc_pipeline_retain(DcmIccPipeline *pipeline);
+
+void dcm_icc_pipeline_release(DcmIccPipeline *pipeline);
+
+/**
+ * Linearizer of a pipeline with 8-bit RGB input, built on first use.
+ * Returns NULL if it cannot be built.
+ */
+const DcmIccLinearizer *dcm_icc_pipeline_get_linearizer(DcmIccPipeline *pipeline);
+
+typedef struct _DcmIccCache DcmIccCache;
+
+/**
+ * Create a cache whose entries are allocated with the allocator of a context
+ */
+DcmIccCache *dcm_icc_cache_create(const DcmIccContext *context, size_t capacity);
+
+void dcm_icc_cache_destroy(DcmIccCache *cache);
+
+/**
+ * Look up a pipeline in a cache (NULL = the process-wide cache). Returns a
+ * new reference or NULL if no pipeline was cached for the key and profile.
+ */
+DcmIccPipeline *dcm_icc_cache_lookup(DcmIccCache *cache,
+                                     const DcmIccPipelineKey *key,
+                                     const char *icc_profile);
+
+/**
+ * Offer a pipeline to a cache (NULL = the process-wide cache). Returns a new
+ * reference to the pipeline that ends up cached for the key, which may
+ * differ from the one passed in if another thread inserted the same key
+ * first.
+ */
+DcmIccPipeline *dcm_icc_cache_insert(DcmIccCache *cache,
+                                     DcmIccPipeline *pipeline,
+                                     const char *icc_profile);
+
+/**
+ * Path of a file in the cache directory, to be freed by the caller. Returns
+ * NULL if no cache directory is set.
+ */
+char *dcm_icc_cache_get_file_path(const char *name);
+
+#endif
@@ -0,0 +1,247 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <lcms2.h>
+
+#include "dicomicc.h"
+#include "pipeline.h"
+#include "profiles.h"
+#include "context.h"
+
+// Position and size of the creation date in the header of an ICC profile
+#define DCM_ICC_PROFILE_DATE_OFFSET 24
+#define DCM_ICC_PROFILE_DATE_SIZE 12
+
+typedef struct _DcmIccOutputProfile DcmIccOutputProfile;
+
+/**
+ * Serialized output profile. Pipelines open their own handle from the
+ * bytes, so that no lcms2 profile handle is shared between threads.
+ */
+struct _DcmIccOutputProfile {
+    DcmIccOutputType output_type;
+    char *data;
+    uint32_t size;
+    uint64_t hash;
+    DcmIccOutputProfile *next;
+};
+
+/**
+ * Process-wide registry of output profiles. The built-in profiles are built
+ * once, when an output profile is first needed.
+ */
+static struct {
+    pthread_once_t once;
+    pthread_mutex_t mutex;
+    DcmIccOutputProfile *head;
+} registry = {
+    .once = PTHREAD_ONCE_INIT,
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static cmsHPROFILE create_builtin_profile(DcmIccOutputType output_type) {
+    switch (output_type) {
+        case DCM_ICC_OUTPUT_SRGB:
+            return create_srgb_profile();
+        case DCM_ICC_OUTPUT_DISPLAY_P3:
+            return create_display_p3_profile();
+        case DCM_ICC_OUTPUT_ADOBE_RGB:
+            return create_adobe_rgb_profile();
+        case DCM_ICC_OUTPUT_ROMM_RGB:
+            return create_romm_rgb_profile();
+        default:
+            return NULL;
+    }
+}
+
+static DcmIccOutputProfile *create_entry(DcmIccOutputType output_type,
+                                         char *data,
+                                         uint32_t size) {
+    DcmIccOutputProfile *entry = calloc(1, sizeof(DcmIccOutputProfile));
+    if (entry == NULL) {
+        free(data);
+        return NULL;
+    }
+
+    entry->output_type = output_type;
+    entry->data = data;
+    entry->size = size;
+    entry->hash = dcm_icc_hash(data, size);
+
+    return entry;
+}
+
+static void destroy_entry(DcmIccOutputProfile *entry) {
+    free(entry->data);
+    free(entry);
+}
+
+/**
+ * Serialize a built-in profile. The creation date is cleared, so that
+ * every process derives the same hash.
+ */
+static DcmIccOutputProfile *serialize_profile(DcmIccOutputType output_type,
+                                              cmsHPROFILE handle) {
+    cmsUInt32Number size = 0;
+    if (!cmsSaveProfileToMem(handle, NULL, &size) ||
+        size < DCM_ICC_PROFILE_DATE_OFFSET + DCM_ICC_PROFILE_DATE_SIZE) {
+        return NULL;
+    }
+
+    char *data = malloc(size);
+    if (data == NULL) {
+        return NULL;
+    }
+    if (!cmsSaveProfileToMem(handle, data, &size)) {
+        free(data);
+        return NULL;
+    }
+    memset(data + DCM_ICC_PROFILE_DATE_OFFSET, 0, DCM_ICC_PROFILE_DATE_SIZE);
+
+    return create_entry(output_type, data, size);
+}
+
+static void register_builtin_profiles(void) {
+    for (uint32_t output_type = DCM_ICC_OUTPUT_SRGB;
+         output_type <= DCM_ICC_OUTPUT_ROMM_RGB;
+         output_type++) {
+        const cmsHPROFILE handle = create_builtin_profile((DcmIccOutputType)output_type);
+        if (handle == NULL) {
+            continue;
+        }
+
+        DcmIccOutputProfile *entry = serialize_profile((DcmIccOutputType)output_type,
+                                                       handle);
+        cmsCloseProfile(handle);
+        if (entry == NULL) {
+            dcm_icc_error(NULL, "Failed to serialize output profile %u", output_type);
+            continue;
+        }
+
+        pthread_mutex_lock(&registry.mutex);
+        entry->next = registry.head;
+        registry.head = entry;
+        pthread_mutex_unlock(&registry.mutex);
+    }
+}
+
+/**
+ * Find the profile of an output type, must be called with the mutex held
+ */
+static DcmIccOutputProfile **find_entry(DcmIccOutputType output_type) {
+    DcmIccOutputProfile **link = &registry.head;
+
+    while (*link != NULL && (*link)->output_type != output_type) {
+        link = &(*link)->next;
+    }
+
+    return link;
+}
+
+bool dcm_icc_output_profile_get_hash(DcmIccOutputType output_type, uint64_t *hash) {
+    pthread_once(&registry.once, register_builtin_profiles);
+
+    pthread_mutex_lock(&registry.mutex);
+    const DcmIccOutputProfile *entry = *find_entry(output_type);
+    if (entry != NULL) {
+        *hash = entry->hash;
+    }
+    pthread_mutex_unlock(&registry.mutex);
+
+    return entry != NULL;
+}
+
+cmsHPROFILE dcm_icc_output_profile_open(cmsContext lcms_context,
+                                        DcmIccOutputType output_type,
+                                        uint64_t hash) {
+    cmsHPROFILE handle = NULL;
+
+    pthread_once(&registry.once, register_builtin_profiles);
+
+    // lcms2 copies the bytes, so the profile may be replaced afterwards
+    pthread_mutex_lock(&registry.mutex);
+    const DcmIccOutputProfile *entry = *find_entry(output_type);
+    const bool found = entry != NULL && entry->hash == hash;
+    if (found) {
+        handle = cmsOpenProfileFromMemTHR(lcms_context, entry->data, entry->size);
+    }
+    pthread_mutex_unlock(&registry.mutex);
+
+    // The key of the pipeline names the profile by its hash, so a profile
+    // replaced in the meantime cannot be used in its place
+    if (!found) {
+        dcm_icc_error(NULL, "Output profile %u was unregistered or replaced "
+                            "while the transform was created", (uint32_t)output_type);
+    } else if (handle == NULL) {
+        dcm_icc_error(NULL, "Failed to open output profile %u", (uint32_t)output_type);
+    }
+
+    return handle;
+}
+
+bool dcm_icc_output_profile_register(DcmIccOutputType output_type,
+                                     const char *icc_profile,
+                                     uint32_t icc_profile_size) {
+    if ((uint32_t)output_type < DCM_ICC_OUTPUT_CUSTOM) {
+        dcm_icc_error(NULL, "Output type %u is reserved for built-in profiles",
+                      (uint32_t)output_type);
+        return false;
+    }
+
+    // Pixels are RGB on both sides of a transform
+    const cmsHPROFILE handle = cmsOpenProfileFromMem(icc_profile, icc_profile_size);
+    if (handle == NULL) {
+        dcm_icc_error(NULL, "Failed to open output profile");
+        return false;
+    }
+    const bool rgb = cmsGetColorSpace(handle) == cmsSigRgbData;
+    cmsCloseProfile(handle);
+    if (!rgb) {
+        dcm_icc_error(NULL, "Output profiles must describe an RGB colour space");
+        return false;
+    }
+
+    char *data = malloc(icc_profile_size);
+    if (data == NULL) {
+        return false;
+    }
+    memcpy(data, icc_profile, icc_profile_size);
+    DcmIccOutputProfile *entry = create_entry(output_type, data, icc_profile_size);
+    if (entry == NULL) {
+        return false;
+    }
+
+    pthread_once(&registry.once, register_builtin_profiles);
+
+    pthread_mutex_lock(&registry.mutex);
+    DcmIccOutputProfile **link = find_entry(output_type);
+    if (*link != NULL) {
+        DcmIccOutputProfile *replaced = *link;
+        *link = replaced->next;
+        destroy_entry(replaced);
+    }
+    entry->next = registry.head;
+    registry.head = entry;
+    pthread_mutex_unlock(&registry.mutex);
+
+    return true;
+}
+
+bool dcm_icc_output_profile_unregister(DcmIccOutputType output_type) {
+    if ((uint32_t)output_type < DCM_ICC_OUTPUT_CUSTOM) {
+        return false;
+    }
+
+    pthread_mutex_lock(&registry.mutex);
+    DcmIccOutputProfile **link = find_entry(output_type);
+    DcmIccOutputProfile *entry = *link;
+    if (entry != NULL) {
+        *link = entry->next;
+        destroy_entry(entry);
+    }
+    pthread_mutex_unlock(&registry.mutex);
+
+    return entry != NULL;
+}
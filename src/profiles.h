@@ -0,0 +1,34 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <lcms2.h>
+
+#include "dicomicc.h"
+
+#ifndef DCM_ICC_PROFILES_INCLUDED
+#define DCM_ICC_PROFILES_INCLUDED
+
+// Built-in output profiles, created from their specifications
+cmsHPROFILE create_srgb_profile(void);
+
+cmsHPROFILE create_display_p3_profile(void);
+
+cmsHPROFILE create_adobe_rgb_profile(void);
+
+cmsHPROFILE create_romm_rgb_profile(void);
+
+/**
+ * Hash of the output profile of an output type, which identifies pipelines
+ * built for it. Returns false if no profile is known for the output type.
+ */
+bool dcm_icc_output_profile_get_hash(DcmIccOutputType output_type, uint64_t *hash);
+
+/**
+ * Open the output profile of an output type in an lcms2 context. Returns
+ * NULL if no profile is known for the output type or if it was replaced
+ * since hash was obtained.
+ */
+cmsHPROFILE dcm_icc_output_profile_open(cmsContext lcms_context,
+                                        DcmIccOutputType output_type,
+                                        uint64_t hash);
+
+#endif
@@ -0,0 +1,390 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "dicomicc.h"
+#include "context.h"
+
+// Default bound of the queue, enough to keep the threads of a large machine
+// busy while limiting the buffers callers keep alive
+#define DCM_ICC_SCHEDULER_DEFAULT_MAX_QUEUED_JOBS 256
+
+struct _DcmIccJob {
+    DcmIccJobRequest request;
+    DcmIccScheduler *scheduler;
+    // Guarded by the scheduler mutex
+    DcmIccJobStatus status;
+    DcmIccJob *next;
+    // Held by the caller and, until the job is finished, the scheduler
+    atomic_uint references;
+};
+
+/**
+ * Jobs wait in a FIFO queue per priority and are taken by the threads of
+ * the scheduler, highest priority first
+ */
+struct _DcmIccScheduler {
+    pthread_mutex_t mutex;
+    pthread_cond_t wakeup;          // A job was queued or shutdown begins
+    pthread_cond_t space;           // A job left the queue
+    pthread_cond_t finished;        // A job is done or cancelled
+    DcmIccJob *heads[DCM_ICC_PRIORITY_LEVELS];
+    DcmIccJob *tails[DCM_ICC_PRIORITY_LEVELS];
+    uint32_t number_of_queued_jobs;
+    uint32_t max_queued_jobs;
+    bool shutdown;
+    DcmIccThreadPool *pool;
+    // Read and write end of the notification pipe, -1 if there is none
+    int fds[2];
+    uint32_t number_of_threads;
+    pthread_t *threads;
+};
+
+static void release_job(DcmIccJob *job) {
+    if (atomic_fetch_sub_explicit(&job->references, 1, memory_order_acq_rel) == 1) {
+        free(job);
+    }
+}
+
+/**
+ * Remove a queued job from its queue. Must be called with the mutex held.
+ */
+static void dequeue_job(DcmIccScheduler *scheduler, DcmIccJob *job) {
+    const DcmIccPriority priority = job->request.priority;
+    DcmIccJob *previous = NULL;
+    DcmIccJob *current = scheduler->heads[priority];
+
+    while (current != NULL && current != job) {
+        previous = current;
+        current = current->next;
+    }
+    if (current == NULL) {
+        return;
+    }
+
+    if (previous == NULL) {
+        scheduler->heads[priority] = job->next;
+    } else {
+        previous->next = job->next;
+    }
+    if (scheduler->tails[priority] == job) {
+        scheduler->tails[priority] = previous;
+    }
+    job->next = NULL;
+    scheduler->number_of_queued_jobs--;
+    pthread_cond_signal(&scheduler->space);
+}
+
+/**
+ * Take the next job by priority. Must be called with the mutex held.
+ */
+static DcmIccJob *pop_job(DcmIccScheduler *scheduler) {
+    for (int priority = 0; priority < DCM_ICC_PRIORITY_LEVELS; priority++) {
+        DcmIccJob *job = scheduler->heads[priority];
+        if (job != NULL) {
+            dequeue_job(scheduler, job);
+            return job;
+        }
+    }
+    return NULL;
+}
+
+static void run_job(DcmIccScheduler *scheduler, DcmIccJob *job) {
+    const DcmIccJobRequest *request = &job->request;
+
+    if (scheduler->pool != NULL) {
+        dcm_icc_transform_apply_parallel(request->icc_transform,
+                                         scheduler->pool,
+                                         request->frame,
+                                         request->frame_size,
+                                         request->corrected_frame);
+    } else {
+        dcm_icc_transform_apply(request->icc_transform,
+                                request->frame,
+                                request->frame_size,
+                                request->corrected_frame);
+    }
+}
+
+/**
+ * Notify the caller, publish the final status of a job and drop the
+ * reference of the scheduler. The status is published after the callback
+ * returns, so that buffers can be freed once dcm_icc_job_wait() returns.
+ * Must be called without the mutex held.
+ */
+static void finish_job(DcmIccScheduler *scheduler, DcmIccJob *job, DcmIccJobStatus status) {
+    if (job->request.callback != NULL) {
+        job->request.callback(job->request.user_data, job, status);
+    }
+
+    pthread_mutex_lock(&scheduler->mutex);
+    job->status = status;
+    pthread_cond_broadcast(&scheduler->finished);
+    pthread_mutex_unlock(&scheduler->mutex);
+
+    if (scheduler->fds[1] != -1) {
+        // A full pipe already signals pending completions
+        const char byte = 0;
+        const ssize_t written = write(scheduler->fds[1], &byte, 1);
+        (void)written;
+    }
+
+    release_job(job);
+}
+
+static void *worker_main(void *arg) {
+    DcmIccScheduler *scheduler = arg;
+
+    pthread_mutex_lock(&scheduler->mutex);
+    for (;;) {
+        while (!scheduler->shutdown && scheduler->number_of_queued_jobs == 0) {
+            pthread_cond_wait(&scheduler->wakeup, &scheduler->mutex);
+        }
+        DcmIccJob *job = pop_job(scheduler);
+        if (job == NULL) {
+            break;
+        }
+        job->status = DCM_ICC_JOB_RUNNING;
+        pthread_mutex_unlock(&scheduler->mutex);
+
+        run_job(scheduler, job);
+        finish_job(scheduler, job, DCM_ICC_JOB_DONE);
+
+        pthread_mutex_lock(&scheduler->mutex);
+    }
+    pthread_mutex_unlock(&scheduler->mutex);
+
+    return NULL;
+}
+
+void dcm_icc_scheduler_options_init(DcmIccSchedulerOptions *options) {
+    options->number_of_threads = 0;
+    options->max_queued_jobs = DCM_ICC_SCHEDULER_DEFAULT_MAX_QUEUED_JOBS;
+    options->pool = NULL;
+    options->notify_fd = false;
+}
+
+/**
+ * Create the notification pipe. Both ends are non-blocking: workers never
+ * wait for readers, and readers drain the pipe until it is empty.
+ */
+static bool open_pipe(int fds[2]) {
+    if (pipe(fds) != 0) {
+        fds[0] = -1;
+        fds[1] = -1;
+        return false;
+    }
+    for (int i = 0; i < 2; i++) {
+        const int flags = fcntl(fds[i], F_GETFL);
+        if (flags == -1 || fcntl(fds[i], F_SETFL, flags | O_NONBLOCK) == -1) {
+            return false;
+        }
+    }
+    return true;
+}
+
+DcmIccScheduler *dcm_icc_scheduler_create(const DcmIccSchedulerOptions *options) {
+    uint32_t number_of_threads = options->number_of_threads;
+    if (number_of_threads == 0) {
+        long number_of_processors = sysconf(_SC_NPROCESSORS_ONLN);
+        number_of_threads = number_of_processors > 0
+            ? (uint32_t)number_of_processors
+            : 1;
+    }
+
+    DcmIccScheduler *scheduler = calloc(1, sizeof(DcmIccScheduler));
+    if (scheduler == NULL) {
+        return NULL;
+    }
+    scheduler->max_queued_jobs = options->max_queued_jobs;
+    scheduler->pool = options->pool;
+    scheduler->fds[0] = -1;
+    scheduler->fds[1] = -1;
+
+    scheduler->threads = calloc(number_of_threads, sizeof(pthread_t));
+    if (scheduler->threads == NULL) {
+        free(scheduler);
+        return NULL;
+    }
+
+    pthread_mutex_init(&scheduler->mutex, NULL);
+    pthread_cond_init(&scheduler->wakeup, NULL);
+    pthread_cond_init(&scheduler->space, NULL);
+    pthread_cond_init(&scheduler->finished, NULL);
+
+    if (options->notify_fd && !open_pipe(scheduler->fds)) {
+        dcm_icc_error(NULL, "Failed to create the notification pipe of the scheduler");
+        dcm_icc_scheduler_destroy(scheduler);
+        return NULL;
+    }
+
+    // Without thread support jobs run when they are submitted
+    for (uint32_t i = 0; i < number_of_threads; i++) {
+        if (pthread_create(&scheduler->threads[i], NULL, worker_main, scheduler) != 0) {
+            if (i == 0) {
+                dcm_icc_error(NULL, "Failed to start scheduler threads, "
+                                    "jobs will run on the submitting thread");
+            }
+            break;
+        }
+        scheduler->number_of_threads++;
+    }
+
+    return scheduler;
+}
+
+int dcm_icc_scheduler_get_fd(const DcmIccScheduler *scheduler) {
+    return scheduler->fds[0];
+}
+
+DcmIccJob *dcm_icc_scheduler_submit(DcmIccScheduler *scheduler,
+                                    const DcmIccJobRequest *request,
+                                    bool block) {
+    if ((uint32_t)request->priority >= DCM_ICC_PRIORITY_LEVELS) {
+        dcm_icc_error(NULL, "Invalid job priority %u", (uint32_t)request->priority);
+        return NULL;
+    }
+
+    DcmIccJob *job = calloc(1, sizeof(DcmIccJob));
+    if (job == NULL) {
+        return NULL;
+    }
+    job->request = *request;
+    job->scheduler = scheduler;
+    job->status = DCM_ICC_JOB_QUEUED;
+    atomic_init(&job->references, 2);
+
+    if (scheduler->number_of_threads == 0) {
+        job->status = DCM_ICC_JOB_RUNNING;
+        run_job(scheduler, job);
+        finish_job(scheduler, job, DCM_ICC_JOB_DONE);
+        return job;
+    }
+
+    pthread_mutex_lock(&scheduler->mutex);
+    while (!scheduler->shutdown && scheduler->max_queued_jobs != 0 &&
+           scheduler->number_of_queued_jobs >= scheduler->max_queued_jobs) {
+        if (!block) {
+            break;
+        }
+        pthread_cond_wait(&scheduler->space, &scheduler->mutex);
+    }
+    if (scheduler->shutdown ||
+        (scheduler->max_queued_jobs != 0 &&
+         scheduler->number_of_queued_jobs >= scheduler->max_queued_jobs)) {
+        pthread_mutex_unlock(&scheduler->mutex);
+        free(job);
+        return NULL;
+    }
+
+    const DcmIccPriority priority = request->priority;
+    if (scheduler->tails[priority] == NULL) {
+        scheduler->heads[priority] = job;
+    } else {
+        scheduler->tails[priority]->next = job;
+    }
+    scheduler->tails[priority] = job;
+    scheduler->number_of_queued_jobs++;
+    pthread_cond_signal(&scheduler->wakeup);
+    pthread_mutex_unlock(&scheduler->mutex);
+
+    return job;
+}
+
+void dcm_icc_scheduler_destroy(DcmIccScheduler *scheduler) {
+    if (scheduler == NULL) {
+        return;
+    }
+
+    if (scheduler->number_of_threads > 0) {
+        // Queued jobs are cancelled, running ones finish
+        DcmIccJob *cancelled = NULL;
+        pthread_mutex_lock(&scheduler->mutex);
+        scheduler->shutdown = true;
+        DcmIccJob *job;
+        while ((job = pop_job(scheduler)) != NULL) {
+            // Taken out of reach of dcm_icc_job_cancel() like running jobs
+            job->status = DCM_ICC_JOB_RUNNING;
+            job->next = cancelled;
+            cancelled = job;
+        }
+        pthread_cond_broadcast(&scheduler->wakeup);
+        pthread_cond_broadcast(&scheduler->space);
+        pthread_mutex_unlock(&scheduler->mutex);
+
+        while (cancelled != NULL) {
+            job = cancelled;
+            cancelled = job->next;
+            finish_job(scheduler, job, DCM_ICC_JOB_CANCELLED);
+        }
+
+        for (uint32_t i = 0; i < scheduler->number_of_threads; i++) {
+            pthread_join(scheduler->threads[i], NULL);
+        }
+    }
+
+    for (int i = 0; i < 2; i++) {
+        if (scheduler->fds[i] != -1) {
+            close(scheduler->fds[i]);
+        }
+    }
+    if (scheduler->threads != NULL) {
+        pthread_cond_destroy(&scheduler->finished);
+        pthread_cond_destroy(&scheduler->space);
+        pthread_cond_destroy(&scheduler->wakeup);
+        pthread_mutex_destroy(&scheduler->mutex);
+    }
+    free(scheduler->threads);
+    free(scheduler);
+}
+
+DcmIccJobStatus dcm_icc_job_get_status(const DcmIccJob *job) {
+    DcmIccScheduler *scheduler = job->scheduler;
+
+    pthread_mutex_lock(&scheduler->mutex);
+    const DcmIccJobStatus status = job->status;
+    pthread_mutex_unlock(&scheduler->mutex);
+
+    return status;
+}
+
+DcmIccJobStatus dcm_icc_job_wait(DcmIccJob *job) {
+    DcmIccScheduler *scheduler = job->scheduler;
+
+    pthread_mutex_lock(&scheduler->mutex);
+    while (job->status == DCM_ICC_JOB_QUEUED || job->status == DCM_ICC_JOB_RUNNING) {
+        pthread_cond_wait(&scheduler->finished, &scheduler->mutex);
+    }
+    const DcmIccJobStatus status = job->status;
+    pthread_mutex_unlock(&scheduler->mutex);
+
+    return status;
+}
+
+bool dcm_icc_job_cancel(DcmIccJob *job) {
+    DcmIccScheduler *scheduler = job->scheduler;
+
+    pthread_mutex_lock(&scheduler->mutex);
+    if (job->status != DCM_ICC_JOB_QUEUED) {
+        pthread_mutex_unlock(&scheduler->mutex);
+        return false;
+    }
+    dequeue_job(scheduler, job);
+    // Not yet finished, but no longer taken by a worker either
+    job->status = DCM_ICC_JOB_RUNNING;
+    pthread_mutex_unlock(&scheduler->mutex);
+
+    finish_job(scheduler, job, DCM_ICC_JOB_CANCELLED);
+
+    return true;
+}
+
+void dcm_icc_job_release(DcmIccJob *job) {
+    if (job) {
+        release_job(job);
+    }
+}
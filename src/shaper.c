@@ -0,0 +1,390 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <math.h>
+#include <lcms2.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define DCM_ICC_X86 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#endif
+
+#include "shaper.h"
+#include "context.h"
+
+// Largest deviation of a matrix coefficient from the identity that is
+// treated as none. Changes linear light by less than half an 8-bit step.
+#define DCM_ICC_SHAPER_IDENTITY_TOLERANCE 5e-4
+
+#define DCM_ICC_SHAPER_MAX_INDEX ((float)(DCM_ICC_SHAPER_OUTPUT_POINTS - 1))
+
+static const cmsTagSignature colorant_tags[3] = {
+    cmsSigRedColorantTag, cmsSigGreenColorantTag, cmsSigBlueColorantTag
+};
+
+static const cmsTagSignature trc_tags[3] = {
+    cmsSigRedTRCTag, cmsSigGreenTRCTag, cmsSigBlueTRCTag
+};
+
+/**
+ * Whether lcms2 evaluates a profile through its matrix and curves for the
+ * intent, rather than through a lookup table
+ */
+static bool is_matrix_shaper(cmsHPROFILE handle, uint32_t intent, int direction) {
+    return cmsGetColorSpace(handle) == cmsSigRgbData &&
+           cmsIsMatrixShaper(handle) &&
+           !cmsIsCLUT(handle, intent, direction);
+}
+
+/**
+ * Matrix from linear RGB to PCS XYZ, the colorants are its columns
+ */
+static bool read_matrix(cmsHPROFILE handle, double matrix[3][3]) {
+    for (int c = 0; c < 3; c++) {
+        const cmsCIEXYZ *colorant = cmsReadTag(handle, colorant_tags[c]);
+        if (colorant == NULL) {
+            return false;
+        }
+        matrix[0][c] = colorant->X;
+        matrix[1][c] = colorant->Y;
+        matrix[2][c] = colorant->Z;
+    }
+    return true;
+}
+
+static bool invert_matrix(const double m[3][3], double inverse[3][3]) {
+    const double det = m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) -
+                       m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) +
+                       m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+    if (fabs(det) < 1e-9) {
+        return false;
+    }
+
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            // Cofactor of m[j][i]
+            const int r0 = (j + 1) % 3;
+            const int r1 = (j + 2) % 3;
+            const int c0 = (i + 1) % 3;
+            const int c1 = (i + 2) % 3;
+            inverse[i][j] = (m[r0][c0] * m[r1][c1] - m[r0][c1] * m[r1][c0]) / det;
+        }
+    }
+    return true;
+}
+
+static uint8_t encode(float value) {
+    if (value <= 0.0f) {
+        return 0;
+    }
+    if (value >= 1.0f) {
+        return 255;
+    }
+    return (uint8_t)(value * 255.0f + 0.5f);
+}
+
+static void kernel_copy(const DcmIccShaper *shaper,
+                        const uint8_t *const src[3],
+                        size_t src_step,
+                        uint8_t *const dst[3],
+                        size_t dst_step,
+                        uint32_t count) {
+    (void)shaper;
+    for (uint32_t i = 0; i < count; i++) {
+        dst[0][i * dst_step] = src[0][i * src_step];
+        dst[1][i * dst_step] = src[1][i * src_step];
+        dst[2][i * dst_step] = src[2][i * src_step];
+    }
+}
+
+static void kernel_curves(const DcmIccShaper *shaper,
+                          const uint8_t *const src[3],
+                          size_t src_step,
+                          uint8_t *const dst[3],
+                          size_t dst_step,
+                          uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        dst[0][i * dst_step] = shaper->curves[0][src[0][i * src_step]];
+        dst[1][i * dst_step] = shaper->curves[1][src[1][i * src_step]];
+        dst[2][i * dst_step] = shaper->curves[2][src[2][i * src_step]];
+    }
+}
+
+static void kernel_matrix_scalar(const DcmIccShaper *shaper,
+                                 const uint8_t *const src[3],
+                                 size_t src_step,
+                                 uint8_t *const dst[3],
+                                 size_t dst_step,
+                                 uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        const float *r = shaper->columns[0][src[0][i * src_step]];
+        const float *g = shaper->columns[1][src[1][i * src_step]];
+        const float *b = shaper->columns[2][src[2][i * src_step]];
+        for (int c = 0; c < 3; c++) {
+            float linear = r[c] + g[c] + b[c];
+            if (linear < 0.0f) {
+                linear = 0.0f;
+            } else if (linear > 1.0f) {
+                linear = 1.0f;
+            }
+            const int32_t index = (int32_t)(sqrtf(linear) * DCM_ICC_SHAPER_MAX_INDEX + 0.5f);
+            dst[c][i * dst_step] = shaper->output[c][index];
+        }
+    }
+}
+
+#if defined(DCM_ICC_X86) && defined(__SSE2__)
+static void kernel_matrix_sse2(const DcmIccShaper *shaper,
+                               const uint8_t *const src[3],
+                               size_t src_step,
+                               uint8_t *const dst[3],
+                               size_t dst_step,
+                               uint32_t count) {
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 scale = _mm_set1_ps(DCM_ICC_SHAPER_MAX_INDEX);
+    const __m128 half = _mm_set1_ps(0.5f);
+    int32_t index[4];
+
+    for (uint32_t i = 0; i < count; i++) {
+        __m128 sum = _mm_add_ps(
+            _mm_loadu_ps(shaper->columns[0][src[0][i * src_step]]),
+            _mm_loadu_ps(shaper->columns[1][src[1][i * src_step]]));
+        sum = _mm_add_ps(sum, _mm_loadu_ps(shaper->columns[2][src[2][i * src_step]]));
+        sum = _mm_sqrt_ps(_mm_min_ps(_mm_max_ps(sum, zero), one));
+        sum = _mm_add_ps(_mm_mul_ps(sum, scale), half);
+        _mm_storeu_si128((__m128i *)index, _mm_cvttps_epi32(sum));
+
+        dst[0][i * dst_step] = shaper->output[0][index[0]];
+        dst[1][i * dst_step] = shaper->output[1][index[1]];
+        dst[2][i * dst_step] = shaper->output[2][index[2]];
+    }
+}
+#endif
+
+#if defined(__ARM_NEON)
+static void kernel_matrix_neon(const DcmIccShaper *shaper,
+                               const uint8_t *const src[3],
+                               size_t src_step,
+                               uint8_t *const dst[3],
+                               size_t dst_step,
+                               uint32_t count) {
+    const float32x4_t zero = vdupq_n_f32(0.0f);
+    const float32x4_t one = vdupq_n_f32(1.0f);
+    const float32x4_t scale = vdupq_n_f32(DCM_ICC_SHAPER_MAX_INDEX);
+    const float32x4_t half = vdupq_n_f32(0.5f);
+    int32_t index[4];
+
+    for (uint32_t i = 0; i < count; i++) {
+        float32x4_t sum = vaddq_f32(vld1q_f32(shaper->columns[0][src[0][i * src_step]]),
+                                    vld1q_f32(shaper->columns[1][src[1][i * src_step]]));
+        sum = vaddq_f32(sum, vld1q_f32(shaper->columns[2][src[2][i * src_step]]));
+        sum = vminq_f32(vmaxq_f32(sum, zero), one);
+        // Square root from the reciprocal square root estimate, refined
+        // once; zero maps to zero as the estimate of 1/0 is infinite
+        float32x4_t estimate = vrsqrteq_f32(sum);
+        estimate = vmulq_f32(estimate, vrsqrtsq_f32(vmulq_f32(sum, estimate), estimate));
+        const float32x4_t root = vbslq_f32(vcgtq_f32(sum, zero),
+                                           vmulq_f32(sum, estimate),
+                                           zero);
+        vst1q_s32(index, vcvtq_s32_f32(vmlaq_f32(half, root, scale)));
+
+        dst[0][i * dst_step] = shaper->output[0][index[0]];
+        dst[1][i * dst_step] = shaper->output[1][index[1]];
+        dst[2][i * dst_step] = shaper->output[2][index[2]];
+    }
+}
+#endif
+
+#if defined(__wasm_simd128__)
+static void kernel_matrix_wasm_simd128(const DcmIccShaper *shaper,
+                                       const uint8_t *const src[3],
+                                       size_t src_step,
+                                       uint8_t *const dst[3],
+                                       size_t dst_step,
+                                       uint32_t count) {
+    const v128_t zero = wasm_f32x4_splat(0.0f);
+    const v128_t one = wasm_f32x4_splat(1.0f);
+    const v128_t scale = wasm_f32x4_splat(DCM_ICC_SHAPER_MAX_INDEX);
+    const v128_t half = wasm_f32x4_splat(0.5f);
+
+    for (uint32_t i = 0; i < count; i++) {
+        v128_t sum = wasm_f32x4_add(wasm_v128_load(shaper->columns[0][src[0][i * src_step]]),
+                                    wasm_v128_load(shaper->columns[1][src[1][i * src_step]]));
+        sum = wasm_f32x4_add(sum, wasm_v128_load(shaper->columns[2][src[2][i * src_step]]));
+        sum = wasm_f32x4_sqrt(wasm_f32x4_pmin(wasm_f32x4_pmax(sum, zero), one));
+        sum = wasm_f32x4_add(wasm_f32x4_mul(sum, scale), half);
+        const v128_t index = wasm_i32x4_trunc_sat_f32x4(sum);
+
+        dst[0][i * dst_step] = shaper->output[0][wasm_i32x4_extract_lane(index, 0)];
+        dst[1][i * dst_step] = shaper->output[1][wasm_i32x4_extract_lane(index, 1)];
+        dst[2][i * dst_step] = shaper->output[2][wasm_i32x4_extract_lane(index, 2)];
+    }
+}
+#endif
+
+/**
+ * Pick the kernel for the class of the transform and, for matrices, the
+ * fastest one supported by the processor we are running on
+ */
+static void select_kernel(DcmIccShaper *shaper) {
+    if (shaper->transform_class == DCM_ICC_CLASS_IDENTITY) {
+        shaper->kernel = kernel_copy;
+        shaper->kernel_name = "identity";
+        return;
+    }
+    if (shaper->transform_class == DCM_ICC_CLASS_CURVES) {
+        shaper->kernel = kernel_curves;
+        shaper->kernel_name = "curves";
+        return;
+    }
+
+    shaper->kernel = kernel_matrix_scalar;
+    shaper->kernel_name = "matrix-scalar";
+
+#if defined(DCM_ICC_X86) && defined(__SSE2__)
+    shaper->kernel = kernel_matrix_sse2;
+    shaper->kernel_name = "matrix-sse2";
+#elif defined(__ARM_NEON)
+    shaper->kernel = kernel_matrix_neon;
+    shaper->kernel_name = "matrix-neon";
+#elif defined(__wasm_simd128__)
+    shaper->kernel = kernel_matrix_wasm_simd128;
+    shaper->kernel_name = "matrix-wasm-simd128";
+#endif
+}
+
+/**
+ * Fill the tables of the shaper from the input curves, the matrix from
+ * input to output linear RGB and the inverted output curves
+ */
+static void populate_tables(DcmIccShaper *shaper,
+                            cmsToneCurve *const input_curves[3],
+                            const double matrix[3][3],
+                            cmsToneCurve *const output_curves[3]) {
+    bool identity_matrix = true;
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            const double expected = i == j ? 1.0 : 0.0;
+            if (fabs(matrix[i][j] - expected) > DCM_ICC_SHAPER_IDENTITY_TOLERANCE) {
+                identity_matrix = false;
+            }
+        }
+    }
+
+    if (identity_matrix) {
+        bool identity = true;
+        for (int c = 0; c < 3; c++) {
+            for (uint32_t value = 0; value < 256; value++) {
+                const float linear = cmsEvalToneCurveFloat(input_curves[c],
+                                                           (float)value / 255.0f);
+                const uint8_t result = encode(cmsEvalToneCurveFloat(output_curves[c],
+                                                                    linear));
+                shaper->curves[c][value] = result;
+                identity = identity && result == value;
+            }
+        }
+        shaper->transform_class = identity
+            ? DCM_ICC_CLASS_IDENTITY
+            : DCM_ICC_CLASS_CURVES;
+        return;
+    }
+
+    shaper->transform_class = DCM_ICC_CLASS_MATRIX;
+    for (int c = 0; c < 3; c++) {
+        for (uint32_t value = 0; value < 256; value++) {
+            const double linear = cmsEvalToneCurveFloat(input_curves[c],
+                                                        (float)value / 255.0f);
+            for (int k = 0; k < 3; k++) {
+                shaper->columns[c][value][k] = (float)(linear * matrix[k][c]);
+            }
+            shaper->columns[c][value][3] = 0.0f;
+        }
+        for (uint32_t i = 0; i < DCM_ICC_SHAPER_OUTPUT_POINTS; i++) {
+            const float root = (float)i / DCM_ICC_SHAPER_MAX_INDEX;
+            shaper->output[c][i] = encode(cmsEvalToneCurveFloat(output_curves[c],
+                                                                root * root));
+        }
+    }
+}
+
+DcmIccShaper *dcm_icc_shaper_create(const DcmIccContext *context,
+                                    cmsHPROFILE in_handle,
+                                    cmsHPROFILE out_handle,
+                                    uint32_t intent,
+                                    bool identity_only,
+                                    DcmIccTransformClass *transform_class) {
+    *transform_class = DCM_ICC_CLASS_GENERAL;
+    if (!is_matrix_shaper(in_handle, intent, LCMS_USED_AS_INPUT) ||
+        !is_matrix_shaper(out_handle, intent, LCMS_USED_AS_OUTPUT)) {
+        return NULL;
+    }
+
+    // Linear input RGB to XYZ to linear output RGB
+    double in_matrix[3][3];
+    double out_matrix[3][3];
+    double out_inverse[3][3];
+    if (!read_matrix(in_handle, in_matrix) ||
+        !read_matrix(out_handle, out_matrix) ||
+        !invert_matrix(out_matrix, out_inverse)) {
+        return NULL;
+    }
+
+    double matrix[3][3];
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            matrix[i][j] = out_inverse[i][0] * in_matrix[0][j] +
+                           out_inverse[i][1] * in_matrix[1][j] +
+                           out_inverse[i][2] * in_matrix[2][j];
+        }
+    }
+
+    // The input curves belong to the profile, the reversed output curves
+    // to us
+    cmsToneCurve *input_curves[3] = { NULL, NULL, NULL };
+    cmsToneCurve *output_curves[3] = { NULL, NULL, NULL };
+    bool curves = true;
+    for (int c = 0; c < 3; c++) {
+        input_curves[c] = cmsReadTag(in_handle, trc_tags[c]);
+        const cmsToneCurve *out_curve = cmsReadTag(out_handle, trc_tags[c]);
+        if (out_curve != NULL) {
+            output_curves[c] = cmsReverseToneCurve(out_curve);
+        }
+        if (input_curves[c] == NULL || output_curves[c] == NULL) {
+            curves = false;
+        }
+    }
+
+    DcmIccShaper *shaper = NULL;
+    if (curves) {
+        shaper = dcm_icc_calloc(context, 1, sizeof(DcmIccShaper));
+    }
+    if (shaper != NULL) {
+        shaper->context = context;
+        populate_tables(shaper, input_curves, matrix, output_curves);
+        select_kernel(shaper);
+        *transform_class = shaper->transform_class;
+        if (identity_only && shaper->transform_class != DCM_ICC_CLASS_IDENTITY) {
+            dcm_icc_shaper_destroy(shaper);
+            shaper = NULL;
+        }
+    }
+
+    for (int c = 0; c < 3; c++) {
+        if (output_curves[c] != NULL) {
+            cmsFreeToneCurve(output_curves[c]);
+        }
+    }
+
+    return shaper;
+}
+
+void dcm_icc_shaper_destroy(DcmIccShaper *shaper) {
+    if (shaper) {
+        dcm_icc_free(shaper->context, shaper);
+    }
+}
@@ -0,0 +1,62 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <lcms2.h>
+
+#include "dicomicc.h"
+
+#ifndef DCM_ICC_SHAPER_INCLUDED
+#define DCM_ICC_SHAPER_INCLUDED
+
+// Entries of the output curves, indexed by the square root of linear light
+// in [0, 1]. Encoding curves are steepest near black, where the square root
+// spreads the entries out.
+#define DCM_ICC_SHAPER_OUTPUT_POINTS 4096
+
+typedef struct _DcmIccShaper DcmIccShaper;
+
+// Transform count pixels, where sample c of pixel i is read from
+// src[c][i * src_step] and written to dst[c][i * dst_step]
+typedef void (*DcmIccShaperKernel)(const DcmIccShaper *shaper,
+                                   const uint8_t *const src[3],
+                                   size_t src_step,
+                                   uint8_t *const dst[3],
+                                   size_t dst_step,
+                                   uint32_t count);
+
+/**
+ * Transform between two matrix/TRC profiles, evaluated as input curves, a
+ * 3x3 matrix and output curves. If the matrix is the identity, the curves
+ * of each channel collapse into a single table of 256 entries.
+ */
+struct _DcmIccShaper {
+    // Context the shaper is allocated in, NULL for malloc()
+    const DcmIccContext *context;
+    DcmIccTransformClass transform_class;
+    // Output value per input value, DCM_ICC_CLASS_CURVES only
+    uint8_t curves[3][256];
+    // Contribution of each input value to the linear output, i.e. the
+    // linearised value times a column of the matrix. Padded to four lanes
+    // for SIMD kernels.
+    float columns[3][256][4];
+    uint8_t output[3][DCM_ICC_SHAPER_OUTPUT_POINTS];
+    DcmIccShaperKernel kernel;
+    const char *kernel_name;
+};
+
+/**
+ * Analyse the transform between two profiles for the given intent and store
+ * its class. Returns NULL if either profile is not an RGB matrix/TRC
+ * profile for the intent, or if identity_only is set and the transform
+ * changes colours; the class is found either way.
+ */
+DcmIccShaper *dcm_icc_shaper_create(const DcmIccContext *context,
+                                    cmsHPROFILE in_handle,
+                                    cmsHPROFILE out_handle,
+                                    uint32_t intent,
+                                    bool identity_only,
+                                    DcmIccTransformClass *transform_class);
+
+void dcm_icc_shaper_destroy(DcmIccShaper *shaper);
+
+#endif
@@ -0,0 +1,178 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "dicomicc.h"
+#include "transform.h"
+#include "context.h"
+
+/**
+ * Decoded pixels are transformed into the corrected frame as soon as the
+ * decoder hands them over, either through the scratch buffer of the sink or
+ * from a tile buffer of the decoder.
+ */
+struct _DcmIccSink {
+    const DmcIccTransform *icc_transform;
+    uint32_t max_rows;
+    // Rows of input pixels written by the decoder
+    char *rows;
+    DcmIccBufferLayout rows_layout;
+    // Frame the corrected pixels are written to, NULL before the first frame
+    char *corrected_frame;
+    DcmIccBufferLayout corrected_layout;
+};
+
+/**
+ * Size in bytes of the samples of a pixel within a row, i.e. of a single
+ * sample for planar pixels
+ */
+static size_t pixel_size(const DmcIccTransform *icc_transform,
+                         const DcmIccFormatInfo *format) {
+    size_t size = format->bytes_per_sample;
+    if (!icc_transform->planar) {
+        size *= format->samples_per_pixel;
+    }
+    return size;
+}
+
+DcmIccSink *dcm_icc_sink_create(const DmcIccTransform *icc_transform,
+                                uint32_t max_rows) {
+    const DcmIccFormatInfo *input = icc_transform->input_format;
+
+    if (icc_transform->columns == 0 || icc_transform->rows == 0) {
+        dcm_icc_error(icc_transform->context, "Invalid sink arguments");
+        return NULL;
+    }
+    if (max_rows == 0 || max_rows > icc_transform->rows) {
+        max_rows = icc_transform->rows;
+    }
+
+    DcmIccSink *sink = dcm_icc_calloc(icc_transform->context, 1, sizeof(DcmIccSink));
+    if (sink == NULL) {
+        return NULL;
+    }
+
+    sink->icc_transform = icc_transform;
+    sink->max_rows = max_rows;
+    sink->rows_layout.row_stride = icc_transform->input_layout.row_stride;
+    if (icc_transform->planar) {
+        sink->rows_layout.plane_stride = (size_t)max_rows * sink->rows_layout.row_stride;
+    }
+
+    const size_t planes = icc_transform->planar ? input->samples_per_pixel : 1;
+    sink->rows = dcm_icc_malloc(icc_transform->context,
+                                planes * max_rows * sink->rows_layout.row_stride);
+    if (sink->rows == NULL) {
+        dcm_icc_sink_destroy(sink);
+        return NULL;
+    }
+
+    return sink;
+}
+
+void dcm_icc_sink_begin(DcmIccSink *sink,
+                        char *corrected_frame,
+                        uint32_t corrected_row_stride,
+                        uint32_t corrected_plane_stride) {
+    sink->corrected_frame = corrected_frame;
+    sink->corrected_layout = sink->icc_transform->output_layout;
+    if (corrected_row_stride != 0) {
+        sink->corrected_layout.row_stride = corrected_row_stride;
+        sink->corrected_layout.plane_stride = corrected_plane_stride;
+    }
+}
+
+char *dcm_icc_sink_get_rows(DcmIccSink *sink, size_t *row_stride) {
+    *row_stride = sink->rows_layout.row_stride;
+    return sink->rows;
+}
+
+bool dcm_icc_sink_commit_rows(DcmIccSink *sink,
+                              uint32_t first_row,
+                              uint32_t number_of_rows) {
+    const DmcIccTransform *icc_transform = sink->icc_transform;
+
+    if (sink->corrected_frame == NULL) {
+        dcm_icc_error(icc_transform->context, "Sink has no frame");
+        return false;
+    }
+    if (number_of_rows > sink->max_rows ||
+        (uint64_t)first_row + number_of_rows > icc_transform->rows) {
+        dcm_icc_error(icc_transform->context, "Rows exceed the sink or the frame");
+        return false;
+    }
+    if (number_of_rows == 0) {
+        return true;
+    }
+
+    const uint64_t start = dcm_icc_transform_begin_call(icc_transform);
+    dcm_icc_transform_block(icc_transform,
+                            sink->rows,
+                            &sink->rows_layout,
+                            sink->corrected_frame +
+                            first_row * sink->corrected_layout.row_stride,
+                            &sink->corrected_layout,
+                            icc_transform->columns,
+                            number_of_rows);
+    dcm_icc_transform_end_call(icc_transform, start,
+                               (uint64_t)icc_transform->columns * number_of_rows);
+
+    return true;
+}
+
+bool dcm_icc_sink_commit_tile(DcmIccSink *sink,
+                              const char *tile,
+                              uint32_t tile_row_stride,
+                              const DcmIccRegion *region) {
+    const DmcIccTransform *icc_transform = sink->icc_transform;
+
+    if (sink->corrected_frame == NULL) {
+        dcm_icc_error(icc_transform->context, "Sink has no frame");
+        return false;
+    }
+    if ((uint64_t)region->x + region->width > icc_transform->columns ||
+        (uint64_t)region->y + region->height > icc_transform->rows) {
+        dcm_icc_error(icc_transform->context, "Region exceeds the frame");
+        return false;
+    }
+    if (icc_transform->input_format->subsampled &&
+        (region->x % 2 != 0 || region->width % 2 != 0)) {
+        dcm_icc_error(icc_transform->context, "Region splits YBR_FULL_422 pixel pairs");
+        return false;
+    }
+    if (region->width == 0 || region->height == 0) {
+        return true;
+    }
+
+    DcmIccBufferLayout tile_layout;
+    tile_layout.row_stride = tile_row_stride != 0
+        ? tile_row_stride
+        : region->width * pixel_size(icc_transform, icc_transform->input_format);
+    tile_layout.plane_stride = icc_transform->planar
+        ? tile_layout.row_stride * region->height
+        : 0;
+
+    const size_t out_pixel_size = pixel_size(icc_transform, icc_transform->output_format);
+    const uint64_t start = dcm_icc_transform_begin_call(icc_transform);
+    dcm_icc_transform_block(icc_transform,
+                            tile,
+                            &tile_layout,
+                            sink->corrected_frame +
+                            region->y * sink->corrected_layout.row_stride +
+                            region->x * out_pixel_size,
+                            &sink->corrected_layout,
+                            region->width,
+                            region->height);
+    dcm_icc_transform_end_call(icc_transform, start,
+                               (uint64_t)region->width * region->height);
+
+    return true;
+}
+
+void dcm_icc_sink_destroy(DcmIccSink *sink) {
+    if (sink) {
+        const DcmIccContext *context = sink->icc_transform->context;
+        dcm_icc_free(context, sink->rows);
+        dcm_icc_free(context, sink);
+    }
+}
@@ -0,0 +1,123 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+
+#include "dicomicc.h"
+#include "stats.h"
+#include "context.h"
+
+// Counters are independent, so relaxed ordering suffices; a snapshot taken
+// during a call may count its pixels but not yet its time.
+#define DCM_ICC_STATS_ADD(counter, value) \
+    atomic_fetch_add_explicit(&(counter), (value), memory_order_relaxed)
+#define DCM_ICC_STATS_LOAD(counter) \
+    atomic_load_explicit(&(counter), memory_order_relaxed)
+#define DCM_ICC_STATS_CLEAR(counter) \
+    atomic_store_explicit(&(counter), 0, memory_order_relaxed)
+
+uint64_t dcm_icc_stats_now(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+DcmIccStatsCounters *dcm_icc_stats_create(const DcmIccContext *context) {
+    DcmIccStatsCounters *counters = dcm_icc_malloc(context, sizeof(DcmIccStatsCounters));
+    if (counters != NULL) {
+        dcm_icc_stats_reset(counters);
+    }
+    return counters;
+}
+
+void dcm_icc_stats_destroy(const DcmIccContext *context, DcmIccStatsCounters *counters) {
+    dcm_icc_free(context, counters);
+}
+
+void dcm_icc_stats_reset(DcmIccStatsCounters *counters) {
+    DCM_ICC_STATS_CLEAR(counters->transforms_created);
+    DCM_ICC_STATS_CLEAR(counters->cache_hits);
+    DCM_ICC_STATS_CLEAR(counters->cache_misses);
+    DCM_ICC_STATS_CLEAR(counters->profile_parse_ns);
+    DCM_ICC_STATS_CLEAR(counters->output_profile_ns);
+    DCM_ICC_STATS_CLEAR(counters->pipeline_build_ns);
+    DCM_ICC_STATS_CLEAR(counters->apply_calls);
+    DCM_ICC_STATS_CLEAR(counters->pixels);
+    DCM_ICC_STATS_CLEAR(counters->apply_ns);
+    for (int i = 0; i < DCM_ICC_STATS_HISTOGRAM_BUCKETS; i++) {
+        DCM_ICC_STATS_CLEAR(counters->histogram[i]);
+    }
+    DCM_ICC_STATS_CLEAR(counters->errors);
+}
+
+void dcm_icc_stats_record_creation(DcmIccStatsCounters *counters,
+                                   const DcmIccCreationTimes *times,
+                                   bool cache_hit) {
+    DCM_ICC_STATS_ADD(counters->transforms_created, 1);
+    if (cache_hit) {
+        DCM_ICC_STATS_ADD(counters->cache_hits, 1);
+        return;
+    }
+    DCM_ICC_STATS_ADD(counters->cache_misses, 1);
+    DCM_ICC_STATS_ADD(counters->profile_parse_ns, times->profile_parse_ns);
+    DCM_ICC_STATS_ADD(counters->output_profile_ns, times->output_profile_ns);
+    DCM_ICC_STATS_ADD(counters->pipeline_build_ns, times->pipeline_build_ns);
+}
+
+/**
+ * Histogram bucket of a call, by the binary logarithm of the microseconds
+ * it took per megapixel
+ */
+static int histogram_bucket(uint64_t elapsed_ns, uint64_t number_of_pixels) {
+    if (number_of_pixels == 0) {
+        return DCM_ICC_STATS_HISTOGRAM_BUCKETS - 1;
+    }
+    const double us_per_megapixel = (double)elapsed_ns * 1000.0 /
+                                    (double)number_of_pixels;
+    int bucket = 0;
+    for (double limit = 2.0; us_per_megapixel >= limit &&
+                             bucket < DCM_ICC_STATS_HISTOGRAM_BUCKETS - 1; limit *= 2.0) {
+        bucket++;
+    }
+    return bucket;
+}
+
+void dcm_icc_stats_record_apply(DcmIccStatsCounters *counters,
+                                uint64_t elapsed_ns,
+                                uint64_t number_of_pixels) {
+    DCM_ICC_STATS_ADD(counters->apply_calls, 1);
+    DCM_ICC_STATS_ADD(counters->pixels, number_of_pixels);
+    DCM_ICC_STATS_ADD(counters->apply_ns, elapsed_ns);
+    DCM_ICC_STATS_ADD(counters->histogram[histogram_bucket(elapsed_ns, number_of_pixels)], 1);
+}
+
+void dcm_icc_stats_record_error(DcmIccStatsCounters *counters) {
+    DCM_ICC_STATS_ADD(counters->errors, 1);
+}
+
+void dcm_icc_stats_snapshot(const DcmIccStatsCounters *counters, DcmIccStats *stats) {
+    // The counters are only read, the cast drops the qualifier for C11
+    // implementations whose atomic loads take non-const pointers
+    DcmIccStatsCounters *source = (DcmIccStatsCounters *)counters;
+
+    memset(stats, 0, sizeof(DcmIccStats));
+    stats->transforms_created = DCM_ICC_STATS_LOAD(source->transforms_created);
+    stats->cache_hits = DCM_ICC_STATS_LOAD(source->cache_hits);
+    stats->cache_misses = DCM_ICC_STATS_LOAD(source->cache_misses);
+    stats->profile_parse_ns = DCM_ICC_STATS_LOAD(source->profile_parse_ns);
+    stats->output_profile_ns = DCM_ICC_STATS_LOAD(source->output_profile_ns);
+    stats->pipeline_build_ns = DCM_ICC_STATS_LOAD(source->pipeline_build_ns);
+    stats->apply_calls = DCM_ICC_STATS_LOAD(source->apply_calls);
+    stats->pixels = DCM_ICC_STATS_LOAD(source->pixels);
+    stats->apply_ns = DCM_ICC_STATS_LOAD(source->apply_ns);
+    for (int i = 0; i < DCM_ICC_STATS_HISTOGRAM_BUCKETS; i++) {
+        stats->histogram[i] = DCM_ICC_STATS_LOAD(source->histogram[i]);
+    }
+    stats->errors = DCM_ICC_STATS_LOAD(source->errors);
+    if (stats->pixels > 0) {
+        stats->ns_per_megapixel = (double)stats->apply_ns * 1000000.0 /
+                                  (double)stats->pixels;
+    }
+}
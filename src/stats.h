@@ -0,0 +1,58 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "dicomicc.h"
+
+#ifndef DCM_ICC_STATS_INCLUDED
+#define DCM_ICC_STATS_INCLUDED
+
+/**
+ * Counters of a transform or a context, updated concurrently by the threads
+ * applying transforms
+ */
+typedef struct {
+    atomic_uint_least64_t transforms_created;
+    atomic_uint_least64_t cache_hits;
+    atomic_uint_least64_t cache_misses;
+    atomic_uint_least64_t profile_parse_ns;
+    atomic_uint_least64_t output_profile_ns;
+    atomic_uint_least64_t pipeline_build_ns;
+    atomic_uint_least64_t apply_calls;
+    atomic_uint_least64_t pixels;
+    atomic_uint_least64_t apply_ns;
+    atomic_uint_least64_t histogram[DCM_ICC_STATS_HISTOGRAM_BUCKETS];
+    atomic_uint_least64_t errors;
+} DcmIccStatsCounters;
+
+// Time spent in the stages of creating a pipeline, all zero on cache hits
+typedef struct {
+    uint64_t profile_parse_ns;
+    uint64_t output_profile_ns;
+    uint64_t pipeline_build_ns;
+} DcmIccCreationTimes;
+
+/**
+ * Monotonic time in nanoseconds
+ */
+uint64_t dcm_icc_stats_now(void);
+
+DcmIccStatsCounters *dcm_icc_stats_create(const DcmIccContext *context);
+
+void dcm_icc_stats_destroy(const DcmIccContext *context, DcmIccStatsCounters *counters);
+
+void dcm_icc_stats_reset(DcmIccStatsCounters *counters);
+
+void dcm_icc_stats_record_creation(DcmIccStatsCounters *counters,
+                                   const DcmIccCreationTimes *times,
+                                   bool cache_hit);
+
+void dcm_icc_stats_record_apply(DcmIccStatsCounters *counters,
+                                uint64_t elapsed_ns,
+                                uint64_t number_of_pixels);
+
+void dcm_icc_stats_record_error(DcmIccStatsCounters *counters);
+
+void dcm_icc_stats_snapshot(const DcmIccStatsCounters *counters, DcmIccStats *stats);
+
+#endif
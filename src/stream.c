@@ -0,0 +1,217 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "dicomicc.h"
+#include "transform.h"
+#include "context.h"
+
+/**
+ * Frames are received as a sequence of bytes. Pixels are transformed strip
+ * by strip as soon as all their samples have arrived. For planar frames this
+ * is the case once the last plane arrives, so all other planes are kept
+ * until then; interleaved frames only need the current strip.
+ */
+struct _DcmIccStream {
+    const DmcIccTransform *icc_transform;
+    DcmIccStreamCallback callback;
+    void *user_data;
+    uint32_t rows_per_strip;
+    // Size in bytes of a row of the part of the frame that is streamed
+    // through the strip, i.e. of the last plane of planar frames
+    size_t row_size;
+    // Planes received before the last one, planar frames only
+    char *planes;
+    size_t planes_size;
+    char *strip;
+    char *corrected_strip;
+    // Bytes of the frame received so far
+    uint64_t position;
+    uint64_t frame_size;
+    // First row of the strip being received
+    uint32_t first_row;
+    bool failed;
+};
+
+DcmIccStream *dcm_icc_stream_create(const DmcIccTransform *icc_transform,
+                                    uint32_t rows_per_strip,
+                                    DcmIccStreamCallback callback,
+                                    void *user_data) {
+    const DcmIccFormatInfo *input = icc_transform->input_format;
+    const DcmIccFormatInfo *output = icc_transform->output_format;
+
+    if (callback == NULL || icc_transform->columns == 0 || icc_transform->rows == 0) {
+        dcm_icc_error(icc_transform->context, "Invalid stream arguments");
+        return NULL;
+    }
+    if (rows_per_strip == 0 || rows_per_strip > icc_transform->rows) {
+        rows_per_strip = icc_transform->rows;
+    }
+
+    DcmIccStream *stream = dcm_icc_calloc(icc_transform->context, 1, sizeof(DcmIccStream));
+    if (stream == NULL) {
+        return NULL;
+    }
+
+    const size_t strip_pixels = (size_t)rows_per_strip * icc_transform->columns;
+    const size_t input_pixel_size = (size_t)input->bytes_per_sample * input->samples_per_pixel;
+    const size_t output_pixel_size = (size_t)output->bytes_per_sample * output->samples_per_pixel;
+
+    stream->icc_transform = icc_transform;
+    stream->callback = callback;
+    stream->user_data = user_data;
+    stream->rows_per_strip = rows_per_strip;
+    stream->frame_size = (uint64_t)icc_transform->number_of_pixels * input_pixel_size;
+    stream->row_size = icc_transform->input_layout.row_stride;
+    if (icc_transform->planar) {
+        stream->planes_size = (input->samples_per_pixel - 1) *
+                              icc_transform->input_layout.plane_stride;
+        stream->planes = dcm_icc_malloc(icc_transform->context, stream->planes_size);
+    }
+    stream->strip = dcm_icc_malloc(icc_transform->context, strip_pixels * input_pixel_size);
+    stream->corrected_strip = dcm_icc_malloc(icc_transform->context,
+                                             strip_pixels * output_pixel_size);
+
+    if ((icc_transform->planar && stream->planes == NULL) ||
+        stream->strip == NULL || stream->corrected_strip == NULL) {
+        dcm_icc_stream_destroy(stream);
+        return NULL;
+    }
+
+    return stream;
+}
+
+/**
+ * Transform the rows of the strip and hand them to the callback
+ */
+static bool flush_strip(DcmIccStream *stream, uint32_t number_of_rows) {
+    const DmcIccTransform *icc_transform = stream->icc_transform;
+    const DcmIccFormatInfo *input = icc_transform->input_format;
+    DcmIccBufferLayout in_layout = icc_transform->input_layout;
+    DcmIccBufferLayout out_layout = icc_transform->output_layout;
+
+    if (icc_transform->planar) {
+        // Planes of strips are as many rows apart as the strip has
+        in_layout.plane_stride = (size_t)number_of_rows * in_layout.row_stride;
+        out_layout.plane_stride = (size_t)number_of_rows * out_layout.row_stride;
+
+        // The last plane was received into the strip, which holds
+        // rows_per_strip rows per plane
+        const size_t last_plane = input->samples_per_pixel - 1;
+        if (number_of_rows < stream->rows_per_strip) {
+            memmove(stream->strip + last_plane * in_layout.plane_stride,
+                    stream->strip + last_plane * stream->rows_per_strip * in_layout.row_stride,
+                    in_layout.plane_stride);
+        }
+        for (size_t plane = 0; plane < last_plane; plane++) {
+            memcpy(stream->strip + plane * in_layout.plane_stride,
+                   stream->planes + plane * icc_transform->input_layout.plane_stride +
+                   (size_t)stream->first_row * in_layout.row_stride,
+                   in_layout.plane_stride);
+        }
+    }
+
+    const uint64_t start = dcm_icc_transform_begin_call(icc_transform);
+    dcm_icc_transform_block(icc_transform,
+                            stream->strip,
+                            &in_layout,
+                            stream->corrected_strip,
+                            &out_layout,
+                            icc_transform->columns,
+                            number_of_rows);
+    dcm_icc_transform_end_call(icc_transform, start,
+                               (uint64_t)icc_transform->columns * number_of_rows);
+
+    const bool success = stream->callback(stream->user_data,
+                                          stream->corrected_strip,
+                                          stream->first_row,
+                                          number_of_rows);
+    stream->first_row += number_of_rows;
+
+    return success;
+}
+
+bool dcm_icc_stream_push(DcmIccStream *stream, const char *data, size_t size) {
+    const DmcIccTransform *icc_transform = stream->icc_transform;
+
+    if (stream->failed) {
+        return false;
+    }
+    if (size > stream->frame_size - stream->position) {
+        dcm_icc_error(icc_transform->context, "Stream received more data than the frame holds");
+        stream->failed = true;
+        return false;
+    }
+
+    // Planes before the last one are kept whole
+    if (stream->position < stream->planes_size) {
+        size_t count = stream->planes_size - stream->position;
+        if (count > size) {
+            count = size;
+        }
+        memcpy(stream->planes + stream->position, data, count);
+        stream->position += count;
+        data += count;
+        size -= count;
+    }
+
+    // Rows of the last plane, or of interleaved frames, fill the strip
+    const size_t strip_size = stream->rows_per_strip * stream->row_size;
+    size_t strip_offset = 0;
+    if (icc_transform->planar) {
+        strip_offset = (icc_transform->input_format->samples_per_pixel - 1) * strip_size;
+    }
+
+    while (size > 0) {
+        const uint64_t streamed = stream->position - stream->planes_size;
+        const size_t filled = (size_t)(streamed - (uint64_t)stream->first_row * stream->row_size);
+        const uint32_t remaining_rows = icc_transform->rows - stream->first_row;
+        const uint32_t strip_rows = remaining_rows < stream->rows_per_strip
+            ? remaining_rows
+            : stream->rows_per_strip;
+        const size_t capacity = strip_rows * stream->row_size;
+
+        size_t count = capacity - filled;
+        if (count > size) {
+            count = size;
+        }
+        memcpy(stream->strip + strip_offset + filled, data, count);
+        stream->position += count;
+        data += count;
+        size -= count;
+
+        if (filled + count == capacity && !flush_strip(stream, strip_rows)) {
+            stream->failed = true;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool dcm_icc_stream_finish(DcmIccStream *stream) {
+    const bool complete = !stream->failed && stream->position == stream->frame_size;
+
+    if (!stream->failed && !complete) {
+        dcm_icc_error(stream->icc_transform->context,
+                      "Stream ended before the end of the frame");
+    }
+
+    // Ready for the next frame
+    stream->position = 0;
+    stream->first_row = 0;
+    stream->failed = false;
+
+    return complete;
+}
+
+void dcm_icc_stream_destroy(DcmIccStream *stream) {
+    if (stream) {
+        const DcmIccContext *context = stream->icc_transform->context;
+        dcm_icc_free(context, stream->planes);
+        dcm_icc_free(context, stream->strip);
+        dcm_icc_free(context, stream->corrected_strip);
+        dcm_icc_free(context, stream);
+    }
+}
@@ -0,0 +1,201 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "dicomicc.h"
+#include "threadpool.h"
+#include "context.h"
+
+typedef struct _DcmIccThreadPoolJob DcmIccThreadPoolJob;
+
+struct _DcmIccThreadPoolJob {
+    DcmIccThreadPoolTask task;
+    void *arg;
+    uint32_t number_of_tasks;
+    uint32_t next_task;
+    uint32_t pending_tasks;
+    pthread_cond_t done;
+    DcmIccThreadPoolJob *next;
+};
+
+struct _DcmIccThreadPool {
+    pthread_mutex_t mutex;
+    pthread_cond_t wakeup;
+    DcmIccThreadPoolJob *head;
+    DcmIccThreadPoolJob *tail;
+    bool shutdown;
+    uint32_t number_of_threads;
+    pthread_t *threads;
+};
+
+static void dequeue_job(DcmIccThreadPool *pool, DcmIccThreadPoolJob *job) {
+    DcmIccThreadPoolJob *previous = NULL;
+    DcmIccThreadPoolJob *current = pool->head;
+
+    while (current != NULL && current != job) {
+        previous = current;
+        current = current->next;
+    }
+    if (current == NULL) {
+        return;
+    }
+
+    if (previous == NULL) {
+        pool->head = job->next;
+    } else {
+        previous->next = job->next;
+    }
+    if (pool->tail == job) {
+        pool->tail = previous;
+    }
+    job->next = NULL;
+}
+
+/**
+ * Execute the next task of a job. Must be called with the pool mutex held
+ * and returns with it held again.
+ */
+static void run_next_task(DcmIccThreadPool *pool, DcmIccThreadPoolJob *job) {
+    const uint32_t index = job->next_task++;
+
+    // Once all tasks are handed out no other thread needs to see the job
+    if (job->next_task == job->number_of_tasks) {
+        dequeue_job(pool, job);
+    }
+
+    pthread_mutex_unlock(&pool->mutex);
+    job->task(job->arg, index);
+    pthread_mutex_lock(&pool->mutex);
+
+    job->pending_tasks--;
+    if (job->pending_tasks == 0) {
+        pthread_cond_broadcast(&job->done);
+    }
+}
+
+static void *worker_main(void *arg) {
+    DcmIccThreadPool *pool = arg;
+
+    pthread_mutex_lock(&pool->mutex);
+    for (;;) {
+        while (!pool->shutdown && pool->head == NULL) {
+            pthread_cond_wait(&pool->wakeup, &pool->mutex);
+        }
+        if (pool->head == NULL) {
+            break;
+        }
+        run_next_task(pool, pool->head);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    return NULL;
+}
+
+DcmIccThreadPool *dcm_icc_thread_pool_create(uint32_t number_of_threads) {
+    if (number_of_threads == 0) {
+        long number_of_processors = sysconf(_SC_NPROCESSORS_ONLN);
+        number_of_threads = number_of_processors > 0
+            ? (uint32_t)number_of_processors
+            : 1;
+    }
+
+    DcmIccThreadPool *pool = calloc(1, sizeof(DcmIccThreadPool));
+    if (pool == NULL) {
+        return NULL;
+    }
+
+    pool->threads = calloc(number_of_threads, sizeof(pthread_t));
+    if (pool->threads == NULL) {
+        free(pool);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->wakeup, NULL);
+
+    // Platforms without thread support (e.g. WASM builds without pthreads)
+    // fail to spawn workers, in which case callers run all tasks themselves.
+    for (uint32_t i = 0; i < number_of_threads; i++) {
+        if (pthread_create(&pool->threads[i], NULL, worker_main, pool) != 0) {
+            if (i == 0) {
+                dcm_icc_error(NULL, "Failed to start worker threads, "
+                                    "transforms will run on the calling thread");
+            }
+            break;
+        }
+        pool->number_of_threads++;
+    }
+
+    return pool;
+}
+
+uint32_t dcm_icc_thread_pool_get_number_of_threads(const DcmIccThreadPool *pool) {
+    return pool ? pool->number_of_threads : 0;
+}
+
+void dcm_icc_thread_pool_run(DcmIccThreadPool *pool,
+                             DcmIccThreadPoolTask task,
+                             void *arg,
+                             uint32_t count) {
+    if (count == 0) {
+        return;
+    }
+
+    if (pool == NULL || pool->number_of_threads == 0 || count == 1) {
+        for (uint32_t i = 0; i < count; i++) {
+            task(arg, i);
+        }
+        return;
+    }
+
+    DcmIccThreadPoolJob job = {
+        .task = task,
+        .arg = arg,
+        .number_of_tasks = count,
+        .next_task = 0,
+        .pending_tasks = count,
+        .next = NULL,
+    };
+    pthread_cond_init(&job.done, NULL);
+
+    pthread_mutex_lock(&pool->mutex);
+    if (pool->tail == NULL) {
+        pool->head = &job;
+    } else {
+        pool->tail->next = &job;
+    }
+    pool->tail = &job;
+    pthread_cond_broadcast(&pool->wakeup);
+
+    // Help with our own job instead of blocking, which also guarantees
+    // progress when all workers are busy with other callers' jobs.
+    while (job.next_task < job.number_of_tasks) {
+        run_next_task(pool, &job);
+    }
+    while (job.pending_tasks > 0) {
+        pthread_cond_wait(&job.done, &pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    pthread_cond_destroy(&job.done);
+}
+
+void dcm_icc_thread_pool_destroy(DcmIccThreadPool *pool) {
+    if (pool) {
+        pthread_mutex_lock(&pool->mutex);
+        pool->shutdown = true;
+        pthread_cond_broadcast(&pool->wakeup);
+        pthread_mutex_unlock(&pool->mutex);
+
+        for (uint32_t i = 0; i < pool->number_of_threads; i++) {
+            pthread_join(pool->threads[i], NULL);
+        }
+
+        pthread_cond_destroy(&pool->wakeup);
+        pthread_mutex_destroy(&pool->mutex);
+        free(pool->threads);
+        free(pool);
+    }
+}
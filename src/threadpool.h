@@ -0,0 +1,22 @@
+#include <stdint.h>
+
+#include "dicomicc.h"
+
+#ifndef DCM_ICC_THREADPOOL_INCLUDED
+#define DCM_ICC_THREADPOOL_INCLUDED
+
+// Task executed by the pool, called once for every index in [0, count)
+typedef void (*DcmIccThreadPoolTask)(void *arg, uint32_t index);
+
+/**
+ * Run a task for all indices in [0, count) and wait for its completion.
+ *
+ * The calling thread takes part in the execution, so the call also makes
+ * progress when the pool is NULL or has no worker threads.
+ */
+void dcm_icc_thread_pool_run(DcmIccThreadPool *pool,
+                             DcmIccThreadPoolTask task,
+                             void *arg,
+                             uint32_t count);
+
+#endif
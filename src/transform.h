@@ -0,0 +1,98 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <lcms2.h>
+
+#include "dicomicc.h"
+#include "pipeline.h"
+#include "stats.h"
+
+#ifndef DCM_ICC_TRANSFORM_INCLUDED
+#define DCM_ICC_TRANSFORM_INCLUDED
+
+typedef enum {
+    DCM_ICC_SAMPLE_UNSIGNED,
+    DCM_ICC_SAMPLE_HALF,
+    DCM_ICC_SAMPLE_FLOAT
+} DcmIccSampleType;
+
+// Memory layout of a pixel format
+typedef struct {
+    cmsUInt32Number type;       // lcms2 format of interleaved pixels
+    DcmIccSampleType sample_type;
+    uint8_t bytes_per_sample;
+    uint8_t samples_per_pixel;
+    bool alpha;
+    uint8_t positions[4];       // Sample (or plane) index of R, G, B and alpha
+    bool ybr;                   // Samples are Y, Cb, Cr
+    bool subsampled;            // Pixel pairs share Cb and Cr (4:2:2)
+} DcmIccFormatInfo;
+
+// Strides in bytes between the rows and the planes of a buffer
+typedef struct {
+    size_t row_stride;
+    size_t plane_stride;
+} DcmIccBufferLayout;
+
+struct _DmcIccTransform {
+    // Context the transform was created in, NULL for process-wide state
+    const DcmIccContext *context;
+    DcmIccPipeline *pipeline;
+    uint32_t number_of_pixels;
+    uint16_t columns;
+    uint16_t rows;
+    bool planar;
+    const DcmIccFormatInfo *input_format;
+    const DcmIccFormatInfo *output_format;
+    DcmIccBufferLayout input_layout;
+    DcmIccBufferLayout output_layout;
+    // Identity transform between equal formats, pixels are copied
+    bool copy;
+    // YBR input that is upsampled and, unless the tables of the pipeline
+    // are indexed by YCbCr, converted to RGB before it is transformed
+    bool unpack;
+    bool ybr_to_rgb;
+    // Alpha handling that the pipeline does not do itself
+    bool copy_alpha;
+    bool fill_alpha;
+    uint8_t alpha_sample[4];
+    // Counters of the transform and of its context, NULL unless collected
+    DcmIccStatsCounters *stats;
+    DcmIccStatsCounters *context_stats;
+};
+
+/**
+ * Layout of a whole frame of a format
+ */
+DcmIccBufferLayout dcm_icc_frame_layout(const DcmIccFormatInfo *format,
+                                        uint32_t columns,
+                                        size_t number_of_pixels,
+                                        bool planar);
+
+/**
+ * Transform a block of pixels. Rows and planes of the input and output may
+ * be laid out independently, the samples of a pixel follow the formats of
+ * the transform.
+ */
+void dcm_icc_transform_block(const DmcIccTransform *icc_transform,
+                             const char *in,
+                             const DcmIccBufferLayout *in_layout,
+                             char *out,
+                             const DcmIccBufferLayout *out_layout,
+                             uint32_t width,
+                             uint32_t height);
+
+/**
+ * Start timing a call that applies the transform. Returns 0 unless the
+ * transform or its context collects statistics.
+ */
+uint64_t dcm_icc_transform_begin_call(const DmcIccTransform *icc_transform);
+
+/**
+ * Count a call started with dcm_icc_transform_begin_call()
+ */
+void dcm_icc_transform_end_call(const DmcIccTransform *icc_transform,
+                                uint64_t start,
+                                uint64_t number_of_pixels);
+
+#endif
@@ -0,0 +1,194 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "dicomicc.h"
+#include "pipeline.h"
+#include "context.h"
+
+// Optical path without an ICC profile
+#define DCM_ICC_NO_TRANSFORM UINT32_MAX
+
+// Distinct ICC profile of a set and the transform created for it
+typedef struct {
+    char *icc_profile;
+    uint32_t icc_profile_size;
+    uint64_t hash;
+    DmcIccTransform *icc_transform;
+} DcmIccTransformSetEntry;
+
+/**
+ * Transforms of the optical paths of an image. Optical paths with identical
+ * profiles share a transform; transforms of different profiles share
+ * pipelines through the cache as usual.
+ */
+struct _DcmIccTransformSet {
+    const DcmIccContext *context;
+    DcmIccTransformOptions options;
+    uint16_t columns;
+    uint16_t rows;
+    DcmIccTransformSetEntry *entries;
+    uint32_t number_of_entries;
+    // Entry of each optical path, DCM_ICC_NO_TRANSFORM if it has none
+    uint32_t *paths;
+    uint32_t number_of_paths;
+    uint32_t capacity;
+};
+
+DcmIccTransformSet *dcm_icc_transform_set_create(uint16_t columns,
+                                                 uint16_t rows,
+                                                 const DcmIccTransformOptions *options) {
+    if (options->lut_path != NULL) {
+        // A single table file cannot hold the tables of several profiles
+        dcm_icc_error(options->context,
+                      "Transform sets keep tables in the cache directory, not in lut_path");
+        return NULL;
+    }
+
+    DcmIccTransformSet *set = dcm_icc_calloc(options->context, 1, sizeof(DcmIccTransformSet));
+    if (set == NULL) {
+        return NULL;
+    }
+
+    set->context = options->context;
+    set->options = *options;
+    set->columns = columns;
+    set->rows = rows;
+
+    return set;
+}
+
+/**
+ * Make room for one more optical path and entry
+ */
+static bool grow(DcmIccTransformSet *set) {
+    if (set->number_of_paths < set->capacity) {
+        return true;
+    }
+
+    const uint32_t capacity = set->capacity == 0 ? 4 : set->capacity * 2;
+    DcmIccTransformSetEntry *entries = dcm_icc_realloc(set->context, set->entries,
+                                                       capacity * sizeof(DcmIccTransformSetEntry));
+    if (entries == NULL) {
+        return false;
+    }
+    set->entries = entries;
+
+    uint32_t *paths = dcm_icc_realloc(set->context, set->paths, capacity * sizeof(uint32_t));
+    if (paths == NULL) {
+        return false;
+    }
+    set->paths = paths;
+    set->capacity = capacity;
+
+    return true;
+}
+
+/**
+ * Entry of the set with the same profile, DCM_ICC_NO_TRANSFORM if there is
+ * none
+ */
+static uint32_t find_entry(const DcmIccTransformSet *set,
+                           const char *icc_profile,
+                           uint32_t icc_profile_size,
+                           uint64_t hash) {
+    for (uint32_t i = 0; i < set->number_of_entries; i++) {
+        const DcmIccTransformSetEntry *entry = &set->entries[i];
+        if (entry->hash == hash &&
+            entry->icc_profile_size == icc_profile_size &&
+            memcmp(entry->icc_profile, icc_profile, icc_profile_size) == 0) {
+            return i;
+        }
+    }
+    return DCM_ICC_NO_TRANSFORM;
+}
+
+int32_t dcm_icc_transform_set_add(DcmIccTransformSet *set,
+                                  const char *icc_profile,
+                                  uint32_t icc_profile_size) {
+    if (set->number_of_paths == INT32_MAX || !grow(set)) {
+        dcm_icc_error(set->context, "Failed to add an optical path to the transform set");
+        return -1;
+    }
+
+    uint32_t index = DCM_ICC_NO_TRANSFORM;
+    if (icc_profile != NULL && icc_profile_size > 0) {
+        const uint64_t hash = dcm_icc_hash(icc_profile, icc_profile_size);
+        index = find_entry(set, icc_profile, icc_profile_size, hash);
+
+        if (index == DCM_ICC_NO_TRANSFORM) {
+            DcmIccTransformSetEntry entry = {
+                .icc_profile = dcm_icc_malloc(set->context, icc_profile_size),
+                .icc_profile_size = icc_profile_size,
+                .hash = hash,
+                .icc_transform = NULL,
+            };
+            if (entry.icc_profile == NULL) {
+                return -1;
+            }
+            memcpy(entry.icc_profile, icc_profile, icc_profile_size);
+
+            entry.icc_transform = dcm_icc_transform_create_with_options(icc_profile,
+                                                                        icc_profile_size,
+                                                                        set->columns,
+                                                                        set->rows,
+                                                                        &set->options);
+            if (entry.icc_transform == NULL) {
+                dcm_icc_free(set->context, entry.icc_profile);
+                return -1;
+            }
+
+            index = set->number_of_entries++;
+            set->entries[index] = entry;
+        }
+    }
+
+    set->paths[set->number_of_paths] = index;
+    return (int32_t)set->number_of_paths++;
+}
+
+uint32_t dcm_icc_transform_set_get_number_of_paths(const DcmIccTransformSet *set) {
+    return set->number_of_paths;
+}
+
+uint32_t dcm_icc_transform_set_get_number_of_transforms(const DcmIccTransformSet *set) {
+    return set->number_of_entries;
+}
+
+const DmcIccTransform *dcm_icc_transform_set_get(const DcmIccTransformSet *set,
+                                                 uint32_t optical_path_index) {
+    if (optical_path_index >= set->number_of_paths ||
+        set->paths[optical_path_index] == DCM_ICC_NO_TRANSFORM) {
+        return NULL;
+    }
+    return set->entries[set->paths[optical_path_index]].icc_transform;
+}
+
+bool dcm_icc_transform_set_apply(const DcmIccTransformSet *set,
+                                 uint32_t optical_path_index,
+                                 const char *frame,
+                                 uint32_t frame_size,
+                                 char *corrected_frame) {
+    const DmcIccTransform *icc_transform = dcm_icc_transform_set_get(set, optical_path_index);
+    if (icc_transform == NULL) {
+        dcm_icc_error(set->context, "Optical path %u has no transform", optical_path_index);
+        return false;
+    }
+
+    dcm_icc_transform_apply(icc_transform, frame, frame_size, corrected_frame);
+
+    return true;
+}
+
+void dcm_icc_transform_set_destroy(DcmIccTransformSet *set) {
+    if (set) {
+        for (uint32_t i = 0; i < set->number_of_entries; i++) {
+            dcm_icc_transform_destroy(set->entries[i].icc_transform);
+            dcm_icc_free(set->context, set->entries[i].icc_profile);
+        }
+        dcm_icc_free(set->context, set->entries);
+        dcm_icc_free(set->context, set->paths);
+        dcm_icc_free(set->context, set);
+    }
+}
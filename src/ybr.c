@@ -0,0 +1,80 @@
+#include <stdint.h>
+#include <stddef.h>
+
+#include "ybr.h"
+
+// Inverse of the YBR_FULL equations of DICOM PS3.3 C.7.6.3.1.2, which are
+// those of JFIF. Coefficients are in units of 2^-DCM_ICC_YBR_SHIFT.
+#define DCM_ICC_YBR_SHIFT 16
+#define DCM_ICC_YBR_ROUND (1 << (DCM_ICC_YBR_SHIFT - 1))
+#define DCM_ICC_YBR_CR_R 91881    // 1.402
+#define DCM_ICC_YBR_CB_G 22554    // 0.344136
+#define DCM_ICC_YBR_CR_G 46802    // 0.714136
+#define DCM_ICC_YBR_CB_B 116130   // 1.772
+
+static inline uint8_t clamp(int32_t value) {
+    if (value < 0) {
+        return 0;
+    }
+    if (value > 255) {
+        return 255;
+    }
+    return (uint8_t)value;
+}
+
+void dcm_icc_ybr_upsample_422(const uint8_t *src, uint8_t *dst, uint32_t count) {
+    for (uint32_t i = 0; i + 1 < count; i += 2) {
+        const uint8_t *pair = src + i * 2;
+        uint8_t *pixels = dst + i * 3;
+        pixels[0] = pair[0];
+        pixels[1] = pair[2];
+        pixels[2] = pair[3];
+        pixels[3] = pair[1];
+        pixels[4] = pair[2];
+        pixels[5] = pair[3];
+    }
+    if (count % 2 != 0) {
+        const uint8_t *pair = src + (count - 1) * 2;
+        uint8_t *pixel = dst + (count - 1) * 3;
+        pixel[0] = pair[0];
+        pixel[1] = pair[2];
+        pixel[2] = pair[3];
+    }
+}
+
+void dcm_icc_ybr_to_rgb(const uint8_t *const src[3],
+                        size_t src_step,
+                        uint8_t *dst,
+                        uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        const int32_t y = src[0][i * src_step];
+        const int32_t cb = (int32_t)src[1][i * src_step] - 128;
+        const int32_t cr = (int32_t)src[2][i * src_step] - 128;
+
+        dst[i * 3] = clamp(y + ((DCM_ICC_YBR_CR_R * cr + DCM_ICC_YBR_ROUND) >>
+                                DCM_ICC_YBR_SHIFT));
+        dst[i * 3 + 1] = clamp(y + ((-DCM_ICC_YBR_CB_G * cb - DCM_ICC_YBR_CR_G * cr +
+                                     DCM_ICC_YBR_ROUND) >> DCM_ICC_YBR_SHIFT));
+        dst[i * 3 + 2] = clamp(y + ((DCM_ICC_YBR_CB_B * cb + DCM_ICC_YBR_ROUND) >>
+                                    DCM_ICC_YBR_SHIFT));
+    }
+}
+
+void dcm_icc_ybr_to_rgb_16(uint16_t *samples, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        uint16_t *pixel = samples + i * 3;
+        // In units of 8-bit values, so that chroma is centred on 128
+        const double y = pixel[0] / 257.0;
+        const double cb = pixel[1] / 257.0 - 128.0;
+        const double cr = pixel[2] / 257.0 - 128.0;
+        const double rgb[3] = {
+            y + 1.402 * cr,
+            y - 0.344136 * cb - 0.714136 * cr,
+            y + 1.772 * cb,
+        };
+        for (int c = 0; c < 3; c++) {
+            double value = rgb[c] < 0.0 ? 0.0 : rgb[c] > 255.0 ? 255.0 : rgb[c];
+            pixel[c] = (uint16_t)(value * 257.0 + 0.5);
+        }
+    }
+}
@@ -0,0 +1,29 @@
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef DCM_ICC_YBR_INCLUDED
+#define DCM_ICC_YBR_INCLUDED
+
+/**
+ * Upsample count pixels of a row of YBR_FULL_422 pixels (Y1 Y2 Cb Cr per
+ * pair, starting at the first pixel of a pair) to interleaved Y, Cb, Cr by
+ * repeating the chroma of each pair
+ */
+void dcm_icc_ybr_upsample_422(const uint8_t *src, uint8_t *dst, uint32_t count);
+
+/**
+ * Convert count pixels from YBR_FULL to interleaved RGB, where sample c of
+ * pixel i is read from src[c][i * src_step]. dst may alias interleaved
+ * input.
+ */
+void dcm_icc_ybr_to_rgb(const uint8_t *const src[3],
+                        size_t src_step,
+                        uint8_t *dst,
+                        uint32_t count);
+
+/**
+ * Convert count interleaved 16-bit pixels from YBR_FULL to RGB in place
+ */
+void dcm_icc_ybr_to_rgb_16(uint16_t *samples, size_t count);
+
+#endif
@@ -0,0 +1,693 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <libgen.h>
+#include <sys/stat.h>
+
+#include <dicom.h>
+
+#include <dicomicc.h>
+
+#define COUNT(array) (sizeof(array) / sizeof((array)[0]))
+
+// Frames queued per scheduler thread, bounds the frames held in memory
+#define CONVERT_QUEUED_FRAMES_PER_THREAD 2
+
+static const struct {
+    DcmIccOutputType type;
+    const char *name;
+} output_types[] = {
+    { DCM_ICC_OUTPUT_SRGB, "srgb" },
+    { DCM_ICC_OUTPUT_DISPLAY_P3, "display-p3" },
+    { DCM_ICC_OUTPUT_ADOBE_RGB, "adobe-rgb" },
+    { DCM_ICC_OUTPUT_ROMM_RGB, "romm-rgb" },
+};
+
+// Transfer syntaxes whose frames are stored uncompressed. Deflated Explicit
+// VR Little Endian is not among them, its dataset is compressed as a whole.
+static const char *uncompressed_transfer_syntaxes[] = {
+    "1.2.840.10008.1.2",        // Implicit VR Little Endian
+    "1.2.840.10008.1.2.1",      // Explicit VR Little Endian
+};
+
+static const struct {
+    const char *photometric_interpretation;
+    DcmIccPixelFormat format;
+} input_formats[] = {
+    { "RGB", DCM_ICC_FORMAT_RGB_8 },
+    { "YBR_FULL", DCM_ICC_FORMAT_YBR_FULL_8 },
+    { "YBR_FULL_422", DCM_ICC_FORMAT_YBR_FULL_422_8 },
+};
+
+// Input file and the file its corrected frames are written to
+typedef struct {
+    char *path;
+    char *output_path;
+} ConvertInput;
+
+typedef struct {
+    const char *output_directory;
+    DcmIccOutputType output_type;
+    DcmIccScheduler *scheduler;
+    ConvertInput *inputs;
+    uint32_t number_of_inputs;
+    atomic_uint next_input;
+    atomic_uint_least64_t frames;
+    atomic_uint_least64_t pixels;
+    atomic_uint_least64_t bytes_read;
+    atomic_uint_least64_t bytes_written;
+    atomic_uint failed_files;
+    // Files whose frames are still being written
+    uint32_t open_files;
+    pthread_mutex_t mutex;
+    pthread_cond_t files_closed;
+} ConvertState;
+
+/**
+ * Output file and transforms of an input file, released by the last of the
+ * reader and the jobs of its frames
+ */
+typedef struct {
+    ConvertState *state;
+    const char *path;
+    int output_fd;
+    DcmIccTransformSet *transform_set;
+    atomic_bool failed;
+    atomic_uint references;
+} ConvertFile;
+
+typedef struct {
+    ConvertFile *file;
+    DcmFrame *frame;
+    char *corrected_frame;
+    uint32_t corrected_frame_size;
+    off_t offset;
+} ConvertJob;
+
+static double now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double)time.tv_sec + (double)time.tv_nsec * 1e-9;
+}
+
+static void release_file(ConvertFile *file) {
+    if (atomic_fetch_sub(&file->references, 1) != 1) {
+        return;
+    }
+
+    ConvertState *state = file->state;
+
+    if (file->output_fd != -1 && close(file->output_fd) != 0) {
+        dcm_log_error("Writing the output of '%s' failed.", file->path);
+        file->failed = true;
+    }
+    dcm_icc_transform_set_destroy(file->transform_set);
+    if (file->failed) {
+        state->failed_files++;
+    } else {
+        dcm_log_info("Converted '%s'.", file->path);
+    }
+    free(file);
+
+    pthread_mutex_lock(&state->mutex);
+    if (--state->open_files == 0) {
+        pthread_cond_signal(&state->files_closed);
+    }
+    pthread_mutex_unlock(&state->mutex);
+}
+
+static bool write_frame(ConvertFile *file, const char *data, uint32_t size, off_t offset) {
+    while (size > 0) {
+        const ssize_t written = pwrite(file->output_fd, data, size, offset);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        size -= (uint32_t)written;
+        offset += written;
+    }
+    return true;
+}
+
+/**
+ * Write a corrected frame at its place in the output file, on a scheduler
+ * thread
+ */
+static void finish_job(void *user_data, DcmIccJob *icc_job, DcmIccJobStatus status) {
+    ConvertJob *job = user_data;
+    ConvertFile *file = job->file;
+    (void)icc_job;
+
+    if (status != DCM_ICC_JOB_DONE ||
+        !write_frame(file, job->corrected_frame, job->corrected_frame_size, job->offset)) {
+        file->failed = true;
+    } else {
+        file->state->bytes_written += job->corrected_frame_size;
+    }
+
+    dcm_frame_destroy(job->frame);
+    free(job->corrected_frame);
+    free(job);
+    release_file(file);
+}
+
+static const DcmElement *get_element(DcmDataSet *dataset, uint32_t tag) {
+    return dataset != NULL ? dcm_dataset_get(dataset, tag) : NULL;
+}
+
+/**
+ * Pixel format of the frames, checking that they are stored uncompressed
+ * with 8 bits per sample
+ */
+static bool get_input_format(const char *path, DcmFrame *frame, DcmIccPixelFormat *format) {
+    const char *transfer_syntax = dcm_frame_get_transfer_syntax_uid(frame);
+    bool uncompressed = false;
+    for (size_t i = 0; i < COUNT(uncompressed_transfer_syntaxes); i++) {
+        if (strcmp(transfer_syntax, uncompressed_transfer_syntaxes[i]) == 0) {
+            uncompressed = true;
+        }
+    }
+    if (!uncompressed) {
+        dcm_log_error("Skipping '%s': transfer syntax %s is not supported, "
+                      "frames must be stored uncompressed.", path, transfer_syntax);
+        return false;
+    }
+    if (dcm_frame_get_bits_allocated(frame) != 8 ||
+        dcm_frame_get_samples_per_pixel(frame) != 3) {
+        dcm_log_error("Skipping '%s': frames must have 3 samples of 8 bits.", path);
+        return false;
+    }
+
+    const char *photometric_interpretation = dcm_frame_get_photometric_interpretation(frame);
+    for (size_t i = 0; i < COUNT(input_formats); i++) {
+        if (strcmp(photometric_interpretation,
+                   input_formats[i].photometric_interpretation) == 0) {
+            *format = input_formats[i].format;
+            return true;
+        }
+    }
+    dcm_log_error("Skipping '%s': photometric interpretation %s is not supported.",
+                  path, photometric_interpretation);
+    return false;
+}
+
+/**
+ * Create the transforms of all optical paths of a file. Returns false if
+ * none of them has an ICC profile.
+ */
+static bool create_transforms(ConvertFile *file,
+                              DcmDataSet *metadata,
+                              DcmFrame *frame,
+                              DcmIccPixelFormat input_format,
+                              uint32_t *number_of_optical_paths) {
+    DcmIccTransformOptions options;
+    dcm_icc_transform_options_init(&options);
+    options.output_type = file->state->output_type;
+    options.planar_configuration = dcm_frame_get_planar_configuration(frame);
+    options.input_format = input_format;
+    options.output_format = DCM_ICC_FORMAT_RGB_8;
+
+    file->transform_set = dcm_icc_transform_set_create(dcm_frame_get_columns(frame),
+                                                       dcm_frame_get_rows(frame),
+                                                       &options);
+    if (file->transform_set == NULL) {
+        return false;
+    }
+
+    const DcmElement *optical_path_element = get_element(metadata, 0x00480105);
+    DcmSequence *optical_path_seq = optical_path_element != NULL
+        ? dcm_element_get_value_SQ(optical_path_element)
+        : NULL;
+    *number_of_optical_paths = optical_path_seq != NULL
+        ? dcm_sequence_count(optical_path_seq)
+        : 0;
+    for (uint32_t i = 0; i < *number_of_optical_paths; i++) {
+        DcmDataSet *optical_path_item = dcm_sequence_get(optical_path_seq, i);
+        const DcmElement *icc_profile_element = get_element(optical_path_item, 0x00282000);
+        const char *icc_profile = NULL;
+        uint32_t icc_profile_length = 0;
+        if (icc_profile_element != NULL) {
+            icc_profile = dcm_element_get_value_OB(icc_profile_element);
+            icc_profile_length = dcm_element_get_length(icc_profile_element);
+        }
+        if (dcm_icc_transform_set_add(file->transform_set,
+                                      icc_profile,
+                                      icc_profile_length) < 0) {
+            return false;
+        }
+    }
+
+    return dcm_icc_transform_set_get_number_of_transforms(file->transform_set) > 0;
+}
+
+/**
+ * Read the frames of a file and submit them to the scheduler, which writes
+ * them to the output file as they are corrected
+ */
+static void convert_file(ConvertState *state, const ConvertInput *input) {
+    const char *path = input->path;
+    ConvertFile *file = calloc(1, sizeof(ConvertFile));
+    if (file == NULL) {
+        state->failed_files++;
+        return;
+    }
+    pthread_mutex_lock(&state->mutex);
+    state->open_files++;
+    pthread_mutex_unlock(&state->mutex);
+    file->state = state;
+    file->path = path;
+    file->output_fd = -1;
+    atomic_init(&file->references, 1);
+
+    DcmFile *dicom_file = dcm_file_create(path, 'r');
+    DcmDataSet *metadata = dicom_file != NULL ? dcm_file_read_metadata(dicom_file) : NULL;
+    DcmBOT *bot = metadata != NULL ? dcm_file_build_bot(dicom_file, metadata) : NULL;
+    DcmFrame *frame = bot != NULL ? dcm_file_read_frame(dicom_file, metadata, bot, 1) : NULL;
+    DcmIccPixelFormat input_format = DCM_ICC_FORMAT_RGB_8;
+    uint32_t number_of_optical_paths = 0;
+    if (frame == NULL) {
+        dcm_log_error("Skipping '%s': reading the file failed.", path);
+        file->failed = true;
+    } else if (!get_input_format(path, frame, &input_format)) {
+        file->failed = true;
+    } else if (!create_transforms(file, metadata, frame, input_format,
+                                  &number_of_optical_paths)) {
+        dcm_log_error("Skipping '%s': the file has no usable ICC profile.", path);
+        file->failed = true;
+    }
+
+    if (!file->failed) {
+        file->output_fd = open(input->output_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (file->output_fd == -1) {
+            dcm_log_error("Creating '%s' failed: %s.", input->output_path, strerror(errno));
+            file->failed = true;
+        }
+    }
+
+    uint32_t number_of_frames = 1;
+    const DcmElement *number_of_frames_element = get_element(metadata, 0x00280008);
+    if (number_of_frames_element != NULL) {
+        const int64_t value = dcm_element_get_value_IS(number_of_frames_element, 0);
+        number_of_frames = value > 0 && value <= UINT32_MAX ? (uint32_t)value : 1;
+    }
+
+    const uint64_t columns = frame != NULL ? dcm_frame_get_columns(frame) : 0;
+    const uint64_t rows = frame != NULL ? dcm_frame_get_rows(frame) : 0;
+    const uint64_t number_of_pixels = columns * rows;
+    const uint64_t frame_size = number_of_pixels *
+                                dcm_icc_pixel_format_get_size(input_format);
+    const uint64_t corrected_frame_size = number_of_pixels *
+                                          dcm_icc_pixel_format_get_size(DCM_ICC_FORMAT_RGB_8);
+    // Frames are transformed and written whole, with 32-bit sizes
+    if (!file->failed && (frame_size > UINT32_MAX || corrected_frame_size > UINT32_MAX)) {
+        dcm_log_error("Skipping '%s': frames of %llu x %llu pixels are too large.",
+                      path, (unsigned long long)columns, (unsigned long long)rows);
+        file->failed = true;
+    }
+    // Frames of TILED_FULL images are ordered by optical path last
+    uint32_t frames_per_optical_path = number_of_frames;
+    if (number_of_optical_paths > 1 && number_of_frames >= number_of_optical_paths) {
+        frames_per_optical_path = number_of_frames / number_of_optical_paths;
+    }
+
+    for (uint32_t frame_number = 1;
+         !file->failed && frame_number <= number_of_frames;
+         frame_number++) {
+        if (frame == NULL) {
+            frame = dcm_file_read_frame(dicom_file, metadata, bot, frame_number);
+        }
+        const uint32_t optical_path_index = (frame_number - 1) / frames_per_optical_path;
+        const DmcIccTransform *icc_transform =
+            frame != NULL
+            ? dcm_icc_transform_set_get(file->transform_set, optical_path_index)
+            : NULL;
+        if (frame != NULL && icc_transform == NULL) {
+            dcm_log_error("Frame #%u of '%s' belongs to optical path #%u, which "
+                          "has no ICC profile.", frame_number, path, optical_path_index + 1);
+            file->failed = true;
+            break;
+        }
+        ConvertJob *job = frame != NULL ? calloc(1, sizeof(ConvertJob)) : NULL;
+        char *corrected_frame = job != NULL ? malloc(corrected_frame_size) : NULL;
+        if (corrected_frame == NULL || dcm_frame_get_length(frame) < frame_size) {
+            dcm_log_error("Converting frame #%u of '%s' failed.", frame_number, path);
+            file->failed = true;
+            free(job);
+            free(corrected_frame);
+            break;
+        }
+
+        job->file = file;
+        job->frame = frame;
+        job->corrected_frame = corrected_frame;
+        job->corrected_frame_size = (uint32_t)corrected_frame_size;
+        job->offset = (off_t)(frame_number - 1) * corrected_frame_size;
+        frame = NULL;
+
+        const DcmIccJobRequest request = {
+            .icc_transform = icc_transform,
+            .frame = dcm_frame_get_value(job->frame),
+            .frame_size = (uint32_t)frame_size,
+            .corrected_frame = corrected_frame,
+            .priority = DCM_ICC_PRIORITY_NORMAL,
+            .callback = finish_job,
+            .user_data = job,
+        };
+        file->references++;
+        // Waits while the queue is full, so that reading never runs ahead
+        // of the transforms by more than the queue
+        DcmIccJob *icc_job = dcm_icc_scheduler_submit(state->scheduler, &request, true);
+        if (icc_job == NULL) {
+            file->references--;
+            file->failed = true;
+            dcm_frame_destroy(job->frame);
+            free(corrected_frame);
+            free(job);
+            break;
+        }
+        dcm_icc_job_release(icc_job);
+
+        state->frames++;
+        state->pixels += number_of_pixels;
+        state->bytes_read += frame_size;
+    }
+
+    if (frame != NULL) {
+        dcm_frame_destroy(frame);
+    }
+    if (bot != NULL) {
+        dcm_bot_destroy(bot);
+    }
+    if (metadata != NULL) {
+        dcm_dataset_destroy(metadata);
+    }
+    if (dicom_file != NULL) {
+        dcm_file_destroy(dicom_file);
+    }
+    release_file(file);
+}
+
+static void *reader_main(void *arg) {
+    ConvertState *state = arg;
+
+    for (;;) {
+        const uint32_t index = state->next_input++;
+        if (index >= state->number_of_inputs) {
+            break;
+        }
+        convert_file(state, &state->inputs[index]);
+    }
+
+    return NULL;
+}
+
+/**
+ * Join a directory, a file name and a suffix, to be freed by the caller
+ */
+static char *join_path(const char *directory, const char *name, const char *suffix) {
+    const size_t size = strlen(directory) + strlen(name) + strlen(suffix) + 2;
+    char *path = malloc(size);
+    if (path != NULL) {
+        snprintf(path, size, "%s/%s%s", directory, name, suffix);
+    }
+    return path;
+}
+
+/**
+ * Name of the last component of a path, to be freed by the caller
+ */
+static char *get_base_name(const char *path) {
+    char *copy = strdup(path);
+    char *name = copy != NULL ? strdup(basename(copy)) : NULL;
+    free(copy);
+    return name;
+}
+
+static bool add_input(ConvertState *state, char *path, char *output_path) {
+    ConvertInput *inputs = realloc(state->inputs,
+                                   (state->number_of_inputs + 1) * sizeof(ConvertInput));
+    if (path == NULL || output_path == NULL || inputs == NULL) {
+        free(path);
+        free(output_path);
+        if (inputs != NULL) {
+            state->inputs = inputs;
+        }
+        return false;
+    }
+    state->inputs = inputs;
+    state->inputs[state->number_of_inputs].path = path;
+    state->inputs[state->number_of_inputs].output_path = output_path;
+    state->number_of_inputs++;
+    return true;
+}
+
+/**
+ * Add a file, or the regular files of a directory, to the inputs. Files of a
+ * directory are written to a subdirectory of the output directory with the
+ * same name, so that files with the same name in different directories do
+ * not overwrite each other.
+ */
+static bool add_path(ConvertState *state, const char *path) {
+    struct stat status;
+    if (stat(path, &status) != 0) {
+        dcm_log_error("Cannot access '%s': %s.", path, strerror(errno));
+        return false;
+    }
+
+    char *name = get_base_name(path);
+    if (name == NULL) {
+        return false;
+    }
+    if (!S_ISDIR(status.st_mode)) {
+        const bool added = add_input(state, strdup(path),
+                                     join_path(state->output_directory, name, ".rgb"));
+        free(name);
+        return added;
+    }
+
+    char *output_directory = join_path(state->output_directory, name, "");
+    free(name);
+    if (output_directory == NULL) {
+        return false;
+    }
+    if (mkdir(output_directory, 0755) != 0 && errno != EEXIST) {
+        dcm_log_error("Creating '%s' failed: %s.", output_directory, strerror(errno));
+        free(output_directory);
+        return false;
+    }
+    DIR *directory = opendir(path);
+    if (directory == NULL) {
+        dcm_log_error("Cannot read directory '%s': %s.", path, strerror(errno));
+        free(output_directory);
+        return false;
+    }
+
+    bool success = true;
+    const struct dirent *entry;
+    while (success && (entry = readdir(directory)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        char *file_path = join_path(path, entry->d_name, "");
+        if (file_path != NULL &&
+            (stat(file_path, &status) != 0 || !S_ISREG(status.st_mode))) {
+            free(file_path);
+            continue;
+        }
+        success = add_input(state, file_path,
+                            join_path(output_directory, entry->d_name, ".rgb"));
+    }
+
+    closedir(directory);
+    free(output_directory);
+    return success;
+}
+
+static int compare_output_paths(const void *a, const void *b) {
+    return strcmp((*(const ConvertInput *const *)a)->output_path,
+                  (*(const ConvertInput *const *)b)->output_path);
+}
+
+/**
+ * Check that no two inputs are written to the same output file, e.g. files
+ * with the same name given on the command line
+ */
+static bool check_output_paths(const ConvertState *state) {
+    if (state->number_of_inputs == 0) {
+        return true;
+    }
+    const ConvertInput **sorted = malloc(state->number_of_inputs * sizeof(ConvertInput *));
+    if (sorted == NULL) {
+        return false;
+    }
+    for (uint32_t i = 0; i < state->number_of_inputs; i++) {
+        sorted[i] = &state->inputs[i];
+    }
+    qsort(sorted, state->number_of_inputs, sizeof(ConvertInput *), compare_output_paths);
+
+    bool unique = true;
+    for (uint32_t i = 1; i < state->number_of_inputs; i++) {
+        if (strcmp(sorted[i - 1]->output_path, sorted[i]->output_path) == 0) {
+            dcm_log_error("'%s' and '%s' would both be written to '%s'.",
+                          sorted[i - 1]->path, sorted[i]->path, sorted[i]->output_path);
+            unique = false;
+        }
+    }
+
+    free(sorted);
+    return unique;
+}
+
+static void usage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s [-t output-type] [-j threads] [-r readers] -o directory "
+            "file-or-directory...\n"
+            "  -o  directory the corrected frames are written to, one .rgb file\n"
+            "      of raw 8-bit RGB frames in frame order per input file, with\n"
+            "      the planar configuration of the input. Files of an input\n"
+            "      directory are written to a subdirectory of the same name.\n"
+            "  -t  srgb (default), display-p3, adobe-rgb or romm-rgb\n"
+            "  -j  threads transforming frames (default: online processors)\n"
+            "  -r  files read at once (default 2)\n"
+            "  -v  report each converted file\n",
+            program);
+}
+
+int main(int argc, char *argv[]) {
+    ConvertState state = {
+        .output_directory = NULL,
+        .output_type = DCM_ICC_OUTPUT_SRGB,
+        .mutex = PTHREAD_MUTEX_INITIALIZER,
+        .files_closed = PTHREAD_COND_INITIALIZER,
+    };
+    uint32_t number_of_threads = 0;
+    uint32_t number_of_readers = 2;
+    int option;
+
+    dcm_log_level = DCM_LOG_WARNING;
+
+    while ((option = getopt(argc, argv, "o:t:j:r:vh")) != -1) {
+        switch (option) {
+            case 'o':
+                state.output_directory = optarg;
+                break;
+            case 't': {
+                bool found = false;
+                for (size_t i = 0; i < COUNT(output_types); i++) {
+                    if (strcmp(optarg, output_types[i].name) == 0) {
+                        state.output_type = output_types[i].type;
+                        found = true;
+                    }
+                }
+                if (!found) {
+                    usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            }
+            case 'j':
+                number_of_threads = (uint32_t)atoi(optarg);
+                break;
+            case 'r':
+                number_of_readers = (uint32_t)atoi(optarg);
+                break;
+            case 'v':
+                dcm_log_level = DCM_LOG_INFO;
+                break;
+            default:
+                usage(argv[0]);
+                return option == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (state.output_directory == NULL || optind == argc) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (number_of_readers == 0) {
+        number_of_readers = 1;
+    }
+
+    for (int i = optind; i < argc; i++) {
+        if (!add_path(&state, argv[i])) {
+            return EXIT_FAILURE;
+        }
+    }
+    if (!check_output_paths(&state)) {
+        return EXIT_FAILURE;
+    }
+
+    if (number_of_threads == 0) {
+        const long number_of_processors = sysconf(_SC_NPROCESSORS_ONLN);
+        number_of_threads = number_of_processors > 0 ? (uint32_t)number_of_processors : 1;
+    }
+    DcmIccSchedulerOptions scheduler_options;
+    dcm_icc_scheduler_options_init(&scheduler_options);
+    scheduler_options.number_of_threads = number_of_threads;
+    scheduler_options.max_queued_jobs = number_of_threads * CONVERT_QUEUED_FRAMES_PER_THREAD;
+    state.scheduler = dcm_icc_scheduler_create(&scheduler_options);
+    if (state.scheduler == NULL) {
+        dcm_log_error("Failed to create the scheduler.");
+        return EXIT_FAILURE;
+    }
+
+    const double start = now();
+
+    // The main thread is one of the readers
+    if (number_of_readers > state.number_of_inputs) {
+        number_of_readers = state.number_of_inputs;
+    }
+    pthread_t *readers = calloc(number_of_readers, sizeof(pthread_t));
+    uint32_t number_of_started_readers = 0;
+    for (uint32_t i = 1; readers != NULL && i < number_of_readers; i++) {
+        if (pthread_create(&readers[number_of_started_readers], NULL,
+                           reader_main, &state) != 0) {
+            break;
+        }
+        number_of_started_readers++;
+    }
+    reader_main(&state);
+    for (uint32_t i = 0; i < number_of_started_readers; i++) {
+        pthread_join(readers[i], NULL);
+    }
+    free(readers);
+
+    // Destroying the scheduler would cancel the frames still queued
+    pthread_mutex_lock(&state.mutex);
+    while (state.open_files > 0) {
+        pthread_cond_wait(&state.files_closed, &state.mutex);
+    }
+    pthread_mutex_unlock(&state.mutex);
+    dcm_icc_scheduler_destroy(state.scheduler);
+
+    const double elapsed = now() - start;
+    const uint32_t failed_files = state.failed_files;
+    printf("files: %u (%u failed)\n", state.number_of_inputs, failed_files);
+    printf("frames: %llu\n", (unsigned long long)state.frames);
+    printf("time: %.3f s\n", elapsed);
+    if (elapsed > 0.0) {
+        printf("throughput: %.1f megapixels/s, %.1f MB/s read, %.1f MB/s written\n",
+               (double)state.pixels / elapsed * 1e-6,
+               (double)state.bytes_read / elapsed * 1e-6,
+               (double)state.bytes_written / elapsed * 1e-6);
+    }
+
+    for (uint32_t i = 0; i < state.number_of_inputs; i++) {
+        free(state.inputs[i].path);
+        free(state.inputs[i].output_path);
+    }
+    free(state.inputs);
+
+    return failed_files == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
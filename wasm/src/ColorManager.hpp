@@ -3,6 +3,8 @@
 extern "C" {
   #include <dicomicc.h>
 }
+#include <algorithm>
+#include <string>
 #include <vector>
 #include <emscripten/val.h>
 
@@ -10,31 +12,64 @@ extern "C" {
 
 using namespace emscripten;
 
+thread_local const val Uint8Array = val::global("Uint8Array");
 thread_local const val Uint8ClampedArray = val::global("Uint8ClampedArray");
+thread_local const val Uint16Array = val::global("Uint16Array");
+thread_local const val Float32Array = val::global("Float32Array");
 
 /// <summary>
 /// JavaScript API for applying ICC color profiles.
+///
+/// Frames are either passed to transform(), which copies them in and out of
+/// the WASM heap, or written directly into the persistent input buffer of
+/// the ColorManager and transformed with transformInto() or
+/// transformInPlace(), which neither allocate nor copy.
 /// </summary>
 class ColorManager {
-  public: 
+  public:
   /// <summary>
   /// Constructor
   /// </summary>
   ColorManager(FrameInfo frameInfo,
                const val &iccProfile,
-               DcmIccOutputType outputType = DCM_ICC_OUTPUT_SRGB) {
+               DcmIccOutputType outputType = DCM_ICC_OUTPUT_SRGB)
+    : ColorManager(frameInfo, iccProfile, outputType,
+                   frameInfo.bitsPerSample > 8 ? DCM_ICC_FORMAT_RGB_16
+                                               : DCM_ICC_FORMAT_RGB_8) {
+  }
+
+  /// <summary>
+  /// Constructor with the pixel format of the transformed frames. Frames with
+  /// more than 8 bits per sample are read as 16-bit samples. Alpha is set to
+  /// opaque for formats with alpha.
+  /// </summary>
+  ColorManager(FrameInfo frameInfo,
+               const val &iccProfile,
+               DcmIccOutputType outputType,
+               DcmIccPixelFormat outputFormat) {
 
     this->frameInfo = frameInfo;
+    this->inputFormat = this->frameInfo.bitsPerSample > 8 ? DCM_ICC_FORMAT_RGB_16
+                                                          : DCM_ICC_FORMAT_RGB_8;
+    this->outputFormat = outputFormat;
 
     const std::vector<uint8_t> iccProfileVector =
       convertJSArrayToNumberVector<uint8_t>(iccProfile);
 
-    this->icc_transform = dcm_icc_transform_create_for_output((const char *) iccProfileVector.data(),
-                                                              (uint32_t) iccProfileVector.size(),
-                                                              this->frameInfo.planarConfiguration,
-                                                              this->frameInfo.columns,
-                                                              this->frameInfo.rows,
-                                                              static_cast<DcmIccOutputType>(outputType));
+    DcmIccTransformOptions options;
+    dcm_icc_transform_options_init(&options);
+    options.output_type = outputType;
+    options.planar_configuration = this->frameInfo.planarConfiguration;
+    options.input_format = this->inputFormat;
+    options.output_format = outputFormat;
+    // Two clock reads per call, negligible next to transforming a frame
+    options.collect_stats = true;
+
+    this->icc_transform = dcm_icc_transform_create_with_options((const char *) iccProfileVector.data(),
+                                                                (uint32_t) iccProfileVector.size(),
+                                                                this->frameInfo.columns,
+                                                                this->frameInfo.rows,
+                                                                &options);
   }
 
   /// <summary>
@@ -43,32 +78,209 @@ class ColorManager {
   ~ColorManager() {
     dcm_icc_transform_destroy(icc_transform);
   }
-  
+
   /// <summary>
   /// Apply ICC color profiles to the input bitstream.
   ///
-  /// Returns a TypedArray of the buffer with the resulting pixel data.
+  /// Returns a TypedArray of the buffer with the resulting pixel data:
+  /// Uint8ClampedArray for 8-bit, Uint16Array for 16-bit and half float and
+  /// Float32Array for float output formats.
   /// </summary>
   val transform(const val &inputFrame) {
 
-    const std::vector<uint8_t> inputFrameVector =
-      convertJSArrayToNumberVector<uint8_t>(inputFrame);
+    this->reserve();
+    this->copyInput(inputFrame);
+    this->transformInto();
 
-    this->output.resize(inputFrameVector.size());
+    // Create a JavaScript-friendly result from the memory view
+    // instead of relying on the consumer to detach it from WASM memory
+    // See https://web.dev/webassembly-memory-debugging/
+    return createTypedArray(this->outputFormat).new_(this->getOutputView());
+  }
+
+  /// <summary>
+  /// Allocate the input and output buffers for one frame in the WASM heap.
+  ///
+  /// Allocating may grow the WASM memory, which detaches every view of it
+  /// (their length becomes 0). Views returned by getInputView() and
+  /// getOutputView() must be obtained again after calling reserve() or
+  /// creating another ColorManager.
+  /// </summary>
+  void reserve() {
+    const size_t numberOfPixels =
+      (size_t) this->frameInfo.columns * this->frameInfo.rows;
+
+    this->input.resize(numberOfPixels * dcm_icc_pixel_format_get_size(this->inputFormat));
+    this->output.resize(numberOfPixels * dcm_icc_pixel_format_get_size(this->outputFormat));
+  }
+
+  /// <summary>
+  /// Free the input and output buffers.
+  /// </summary>
+  void release() {
+    std::vector<uint8_t>().swap(this->input);
+    std::vector<uint8_t>().swap(this->output);
+  }
+
+  /// <summary>
+  /// Returns a Uint8Array view of the input buffer in the WASM heap, into
+  /// which the frame is written before calling transformInto() or
+  /// transformInPlace(). Call reserve() first.
+  /// </summary>
+  val getInputView() {
+    return val(typed_memory_view(this->input.size(), this->input.data()));
+  }
+
+  /// <summary>
+  /// Returns a view of the output buffer in the WASM heap, typed like the
+  /// result of transform().
+  /// </summary>
+  val getOutputView() {
+    return createView(this->outputFormat, this->output.data(), this->output.size());
+  }
+
+  /// <summary>
+  /// Transform the input buffer into the output buffer. Returns false if the
+  /// buffers have not been reserved.
+  /// </summary>
+  bool transformInto() {
+    if (this->input.empty()) {
+      return false;
+    }
 
     dcm_icc_transform_apply(this->icc_transform,
-                            (const char *) inputFrameVector.data(),
-                            (uint32_t) inputFrameVector.size(),
+                            (const char *) this->input.data(),
+                            (uint32_t) this->input.size(),
                             (char *) this->output.data());
+    return true;
+  }
 
-    // Create a JavaScript-friendly result from the memory view
-    // instead of relying on the consumer to detach it from WASM memory
-    // See https://web.dev/webassembly-memory-debugging/
-    val js_result = Uint8ClampedArray.new_(typed_memory_view(
-      this->output.size(), this->output.data()
-    ));
+  /// <summary>
+  /// Same as transformInto(), but splits the frame into row stripes that are
+  /// transformed concurrently by the shared worker threads. Without pthreads
+  /// the frame is transformed on the calling thread.
+  /// </summary>
+  bool transformParallel() {
+    if (this->input.empty()) {
+      return false;
+    }
 
-    return js_result;
+    dcm_icc_transform_apply_parallel(this->icc_transform,
+                                     getThreadPool(),
+                                     (const char *) this->input.data(),
+                                     (uint32_t) this->input.size(),
+                                     (char *) this->output.data());
+    return true;
+  }
+
+  /// <summary>
+  /// Apply ICC color profiles to an array of frames, which are spread across
+  /// the shared worker threads.
+  ///
+  /// Returns an array with a TypedArray per frame, typed like the result of
+  /// transform().
+  /// </summary>
+  val transformBatch(const val &inputFrames) {
+    const uint32_t numberOfFrames = inputFrames["length"].as<uint32_t>();
+    const size_t numberOfPixels =
+      (size_t) this->frameInfo.columns * this->frameInfo.rows;
+    const size_t inputSize =
+      numberOfPixels * dcm_icc_pixel_format_get_size(this->inputFormat);
+    const size_t outputSize =
+      numberOfPixels * dcm_icc_pixel_format_get_size(this->outputFormat);
+
+    // All frames are copied into the heap first, so that the library can
+    // schedule them across the workers in one call
+    std::vector<uint8_t> batchInput(inputSize * numberOfFrames);
+    std::vector<uint8_t> batchOutput(outputSize * numberOfFrames);
+    std::vector<DcmIccBatchItem> items(numberOfFrames);
+
+    for (uint32_t i = 0; i < numberOfFrames; i++) {
+      copyBytes(inputFrames[i], batchInput.data() + i * inputSize, inputSize);
+
+      items[i].frame = (const char *) batchInput.data() + i * inputSize;
+      items[i].frame_size = (uint32_t) inputSize;
+      items[i].corrected_frame = (char *) batchOutput.data() + i * outputSize;
+      items[i].corrected_frame_size = (uint32_t) outputSize;
+      items[i].columns = 0;
+      items[i].rows = 0;
+    }
+
+    dcm_icc_transform_apply_batch(this->icc_transform,
+                                  getThreadPool(),
+                                  items.data(),
+                                  numberOfFrames);
+
+    val results = val::array();
+    for (uint32_t i = 0; i < numberOfFrames; i++) {
+      results.call<void>("push", createTypedArray(this->outputFormat).new_(
+        createView(this->outputFormat, batchOutput.data() + i * outputSize, outputSize)));
+    }
+
+    return results;
+  }
+
+  /// <summary>
+  /// Number of worker threads shared by all ColorManagers, 0 unless the
+  /// module was built with pthreads.
+  /// </summary>
+  static uint32_t getNumberOfThreads() {
+    return dcm_icc_thread_pool_get_number_of_threads(getThreadPool());
+  }
+
+  /// <summary>
+  /// Returns the statistics of the transform: creation time per stage, cache
+  /// hits and misses, and the number, pixels and duration of transform calls,
+  /// with a histogram of calls by microseconds per megapixel. Counts are
+  /// plain numbers, exact up to 2^53.
+  /// </summary>
+  val getStats() const {
+    DcmIccStats stats;
+    if (!dcm_icc_transform_get_stats(this->icc_transform, &stats)) {
+      return val::null();
+    }
+
+    val histogram = val::array();
+    for (uint32_t i = 0; i < DCM_ICC_STATS_HISTOGRAM_BUCKETS; i++) {
+      histogram.call<void>("push", (double) stats.histogram[i]);
+    }
+
+    val result = val::object();
+    result.set("kernelName", std::string(stats.kernel_name));
+    result.set("cacheHits", (double) stats.cache_hits);
+    result.set("cacheMisses", (double) stats.cache_misses);
+    result.set("profileParseNs", (double) stats.profile_parse_ns);
+    result.set("outputProfileNs", (double) stats.output_profile_ns);
+    result.set("pipelineBuildNs", (double) stats.pipeline_build_ns);
+    result.set("applyCalls", (double) stats.apply_calls);
+    result.set("pixels", (double) stats.pixels);
+    result.set("applyNs", (double) stats.apply_ns);
+    result.set("nsPerMegapixel", stats.ns_per_megapixel);
+    result.set("histogram", histogram);
+    return result;
+  }
+
+  /// <summary>
+  /// Reset the statistics returned by getStats().
+  /// </summary>
+  void resetStats() {
+    dcm_icc_transform_reset_stats(this->icc_transform);
+  }
+
+  /// <summary>
+  /// Transform the input buffer in place. Only possible if the output pixel
+  /// format equals the input pixel format, returns false otherwise or if the
+  /// buffers have not been reserved.
+  /// </summary>
+  bool transformInPlace() {
+    if (this->input.empty()) {
+      return false;
+    }
+
+    return dcm_icc_transform_apply_in_place(this->icc_transform,
+                                            NULL,
+                                            (char *) this->input.data(),
+                                            (uint32_t) this->input.size());
   }
 
   /// <summary>
@@ -79,7 +291,75 @@ class ColorManager {
   }
 
   private:
+    static DcmIccThreadPool *getThreadPool() {
+#ifdef __EMSCRIPTEN_PTHREADS__
+      // One worker per logical core, shared for the lifetime of the module
+      static DcmIccThreadPool *pool = dcm_icc_thread_pool_create(0);
+      return pool;
+#else
+      return NULL;
+#endif
+    }
+
+    void copyInput(const val &inputFrame) {
+      copyBytes(inputFrame, this->input.data(), this->input.size());
+    }
+
+    /// <summary>
+    /// Copy the bytes of a frame into the heap, whatever the element type of
+    /// the array, with a single TypedArray.set() instead of element by
+    /// element.
+    /// </summary>
+    static void copyBytes(const val &inputFrame, uint8_t *destination, size_t capacity) {
+      const val inputBytes = Uint8Array.new_(inputFrame["buffer"],
+                                             inputFrame["byteOffset"],
+                                             inputFrame["byteLength"]);
+      const size_t inputSize = std::min<size_t>(inputBytes["length"].as<size_t>(),
+                                                capacity);
+      val(typed_memory_view(inputSize, destination)).call<void>("set",
+        inputBytes.call<val>("subarray", 0, inputSize));
+    }
+
+    /// <summary>
+    /// View of pixels in the heap, typed according to the pixel format.
+    /// </summary>
+    static val createView(DcmIccPixelFormat format, const uint8_t *data, size_t size) {
+      switch (format) {
+        case DCM_ICC_FORMAT_RGB_FLOAT:
+        case DCM_ICC_FORMAT_RGBA_FLOAT:
+          return val(typed_memory_view(size / sizeof(float), (const float *) data));
+        case DCM_ICC_FORMAT_RGB_16:
+        case DCM_ICC_FORMAT_RGB_HALF:
+        case DCM_ICC_FORMAT_RGBA_16:
+        case DCM_ICC_FORMAT_RGBA_HALF:
+        case DCM_ICC_FORMAT_RGBX_16:
+          return val(typed_memory_view(size / sizeof(uint16_t), (const uint16_t *) data));
+        default:
+          return val(typed_memory_view(size, data));
+      }
+    }
+
+    static val createTypedArray(DcmIccPixelFormat format) {
+      switch (format) {
+        case DCM_ICC_FORMAT_RGB_FLOAT:
+        case DCM_ICC_FORMAT_RGBA_FLOAT:
+          return Float32Array;
+        case DCM_ICC_FORMAT_RGB_16:
+        case DCM_ICC_FORMAT_RGB_HALF:
+        case DCM_ICC_FORMAT_RGBA_16:
+        case DCM_ICC_FORMAT_RGBA_HALF:
+        case DCM_ICC_FORMAT_RGBX_16:
+          return Uint16Array;
+        default:
+          // Suitable for new ImageData() with the RGBA_8 format
+          return Uint8ClampedArray;
+      }
+    }
+
+    std::vector<uint8_t> input;
     std::vector<uint8_t> output;
     FrameInfo frameInfo;
+    DcmIccPixelFormat inputFormat;
+    DcmIccPixelFormat outputFormat;
     DmcIccTransform *icc_transform;
 };
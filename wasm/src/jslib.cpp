@@ -18,6 +18,23 @@ EMSCRIPTEN_BINDINGS(DcmIccOutputType) {
   ;
 }
 
+EMSCRIPTEN_BINDINGS(DcmIccPixelFormat) {
+  enum_<DcmIccPixelFormat>("DcmIccPixelFormat")
+    .value("RGB_8", DCM_ICC_FORMAT_RGB_8)
+    .value("RGB_16", DCM_ICC_FORMAT_RGB_16)
+    .value("RGB_HALF", DCM_ICC_FORMAT_RGB_HALF)
+    .value("RGB_FLOAT", DCM_ICC_FORMAT_RGB_FLOAT)
+    .value("RGBA_8", DCM_ICC_FORMAT_RGBA_8)
+    .value("RGBA_16", DCM_ICC_FORMAT_RGBA_16)
+    .value("RGBA_HALF", DCM_ICC_FORMAT_RGBA_HALF)
+    .value("RGBA_FLOAT", DCM_ICC_FORMAT_RGBA_FLOAT)
+    .value("RGBX_8", DCM_ICC_FORMAT_RGBX_8)
+    .value("RGBX_16", DCM_ICC_FORMAT_RGBX_16)
+    .value("BGRA_8", DCM_ICC_FORMAT_BGRA_8)
+    .value("ARGB_8", DCM_ICC_FORMAT_ARGB_8)
+  ;
+}
+
 EMSCRIPTEN_BINDINGS(FrameInfo) {
   value_object<FrameInfo>("FrameInfo")
     .field("columns", &FrameInfo::columns)
@@ -31,8 +48,20 @@ EMSCRIPTEN_BINDINGS(FrameInfo) {
 EMSCRIPTEN_BINDINGS(ColorManager) {
   class_<ColorManager>("ColorManager")
     .constructor<FrameInfo, const val, DcmIccOutputType>()
+    .constructor<FrameInfo, const val, DcmIccOutputType, DcmIccPixelFormat>()
     .function("getFrameInfo", &ColorManager::getFrameInfo)
     .function("transform", &ColorManager::transform)
+    .function("reserve", &ColorManager::reserve)
+    .function("release", &ColorManager::release)
+    .function("getInputView", &ColorManager::getInputView)
+    .function("getOutputView", &ColorManager::getOutputView)
+    .function("transformInto", &ColorManager::transformInto)
+    .function("transformInPlace", &ColorManager::transformInPlace)
+    .function("transformParallel", &ColorManager::transformParallel)
+    .function("transformBatch", &ColorManager::transformBatch)
+    .function("getStats", &ColorManager::getStats)
+    .function("resetStats", &ColorManager::resetStats)
+    .class_function("getNumberOfThreads", &ColorManager::getNumberOfThreads)
   ;
 }
 